@@ -0,0 +1,460 @@
+// lidx_bench: measures the performance of lidx on a synthetic corpus.
+//
+// usage: lidx_bench [-d docs] [-w words_per_doc] [-v vocabulary] [-q queries]
+//                   [-r removals] [-c cache_mb] [-j threads] [-t timeout_ms]
+//                   [-m] [-s seed] [-p index_path] [-o output.json]
+//
+// The corpus is generated deterministically from the seed. Words are drawn
+// from a Zipfian distribution over a vocabulary of Latin, accented and CJK
+// words.
+// -c enables the query cache with the given size. Queries are drawn from the
+// same Zipfian distribution, so popular tokens are searched several times.
+// -j sets the number of threads of the substring and suffix searches.
+// -t runs the searches with `lidx_search_start()` and the given deadline, and
+// reports how many of them were truncated.
+// -m stores the index in memory instead of index_path.
+// index_path is removed before the run. It must be missing, empty or an index.
+// The results are written as JSON to the standard output or to the file
+// given with -o.
+
+#include "lidx.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct bench_config {
+  unsigned int docs_count;
+  unsigned int words_per_doc;
+  unsigned int vocabulary_size;
+  unsigned int queries_count;
+  unsigned int removals_count;
+  unsigned int query_cache_mb;
+  unsigned int search_threads;
+  unsigned int search_timeout_ms;
+  int in_memory;
+  uint64_t seed;
+  const char * index_path;
+  const char * output_path;
+};
+
+// Deterministic random generator (splitmix64).
+
+static uint64_t bench_random(uint64_t * state)
+{
+  uint64_t z = (* state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static double bench_random_double(uint64_t * state)
+{
+  return (bench_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Synthetic corpus.
+
+struct bench_word {
+  // Text of the word in UTF-8.
+  std::string text;
+  // ASCII form of the word, empty for CJK words.
+  std::string ascii;
+};
+
+struct bench_corpus {
+  std::vector<bench_word> vocabulary;
+  // Cumulative distribution of the Zipfian law.
+  std::vector<double> cdf;
+};
+
+static void bench_append_utf8(std::string & buffer, unsigned int c)
+{
+  if (c < 0x80) {
+    buffer.push_back((char) c);
+  }
+  else if (c < 0x800) {
+    buffer.push_back((char) (0xc0 | (c >> 6)));
+    buffer.push_back((char) (0x80 | (c & 0x3f)));
+  }
+  else {
+    buffer.push_back((char) (0xe0 | (c >> 12)));
+    buffer.push_back((char) (0x80 | ((c >> 6) & 0x3f)));
+    buffer.push_back((char) (0x80 | (c & 0x3f)));
+  }
+}
+
+static void bench_generate_vocabulary(bench_corpus * corpus, unsigned int size, uint64_t * state)
+{
+  static const char * consonants = "bcdfghjklmnprstvz";
+  static const char * vowels = "aeiou";
+  // Accented variants of a, e, i, o, u.
+  static const unsigned int accented_vowels[] = { 0xe0, 0xe9, 0xef, 0xf4, 0xfc };
+
+  for(unsigned int i = 0 ; i < size ; i ++) {
+    bench_word word;
+    double kind = bench_random_double(state);
+    if (kind < 0.1) {
+      // CJK word.
+      unsigned int length = 1 + bench_random(state) % 3;
+      for(unsigned int k = 0 ; k < length ; k ++) {
+        bench_append_utf8(word.text, 0x4e00 + bench_random(state) % 0x5000);
+      }
+    }
+    else {
+      int accented = (kind < 0.25);
+      unsigned int syllables = 1 + bench_random(state) % 4;
+      for(unsigned int k = 0 ; k < syllables ; k ++) {
+        word.ascii.push_back(consonants[bench_random(state) % strlen(consonants)]);
+        word.text.push_back(word.ascii[word.ascii.size() - 1]);
+        unsigned int vowel = bench_random(state) % strlen(vowels);
+        word.ascii.push_back(vowels[vowel]);
+        if (accented && (bench_random(state) % 2 == 0)) {
+          bench_append_utf8(word.text, accented_vowels[vowel]);
+        }
+        else {
+          word.text.push_back(vowels[vowel]);
+        }
+      }
+      if (bench_random(state) % 2 == 0) {
+        word.ascii.push_back(consonants[bench_random(state) % strlen(consonants)]);
+        word.text.push_back(word.ascii[word.ascii.size() - 1]);
+      }
+    }
+    corpus->vocabulary.push_back(word);
+  }
+
+  double sum = 0;
+  corpus->cdf.resize(size);
+  for(unsigned int i = 0 ; i < size ; i ++) {
+    sum += 1.0 / pow(i + 1, 1.07);
+    corpus->cdf[i] = sum;
+  }
+  for(unsigned int i = 0 ; i < size ; i ++) {
+    corpus->cdf[i] /= sum;
+  }
+}
+
+static const bench_word & bench_pick_word(bench_corpus * corpus, uint64_t * state)
+{
+  double value = bench_random_double(state);
+  size_t rank = std::lower_bound(corpus->cdf.begin(), corpus->cdf.end(), value) - corpus->cdf.begin();
+  if (rank >= corpus->vocabulary.size()) {
+    rank = corpus->vocabulary.size() - 1;
+  }
+  return corpus->vocabulary[rank];
+}
+
+static std::string bench_generate_document(bench_corpus * corpus, unsigned int words_count, uint64_t * state)
+{
+  std::string text;
+  for(unsigned int i = 0 ; i < words_count ; i ++) {
+    if (i > 0) {
+      text.append((bench_random(state) % 10 == 0) ? ", " : " ");
+    }
+    text.append(bench_pick_word(corpus, state).text);
+  }
+  return text;
+}
+
+// Measurements.
+
+static double bench_now(void)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double bench_percentile(std::vector<double> & values, double percentile)
+{
+  if (values.size() == 0) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t position = (size_t) (percentile * (values.size() - 1) + 0.5);
+  return values[position];
+}
+
+static uint64_t bench_disk_size(const char * path)
+{
+  uint64_t size = 0;
+  DIR * dir = opendir(path);
+  if (dir == NULL) {
+    return 0;
+  }
+  struct dirent * entry;
+  while ((entry = readdir(dir)) != NULL) {
+    std::string filename = std::string(path) + "/" + entry->d_name;
+    struct stat stat_info;
+    if ((stat(filename.c_str(), &stat_info) == 0) && S_ISREG(stat_info.st_mode)) {
+      size += stat_info.st_size;
+    }
+  }
+  closedir(dir);
+  return size;
+}
+
+// Removes the index left by a previous run. Returns -1 if `path` is neither
+// missing, an empty directory nor a LevelDB database (with a CURRENT or a
+// LOCK file), so that a wrong -p doesn't wipe another directory.
+static int bench_remove_index(const char * path)
+{
+  DIR * dir = opendir(path);
+  if (dir == NULL) {
+    return (errno == ENOENT) ? 0 : -1;
+  }
+  std::vector<std::string> filenames;
+  int is_index = 0;
+  struct dirent * entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) {
+      continue;
+    }
+    if ((strcmp(entry->d_name, "CURRENT") == 0) || (strcmp(entry->d_name, "LOCK") == 0)) {
+      is_index = 1;
+    }
+    filenames.push_back(entry->d_name);
+  }
+  closedir(dir);
+  if ((filenames.size() > 0) && !is_index) {
+    return -1;
+  }
+  for(size_t i = 0 ; i < filenames.size() ; i ++) {
+    std::string filename = std::string(path) + "/" + filenames[i];
+    unlink(filename.c_str());
+  }
+  rmdir(path);
+  return 0;
+}
+
+static std::string bench_query_token(const bench_word & word, lidx_search_kind kind)
+{
+  const std::string & ascii = word.ascii;
+  size_t length = std::min((size_t) 3, ascii.size());
+  switch (kind) {
+    case lidx_search_kind_prefix:
+      return ascii.substr(0, length);
+    case lidx_search_kind_substr:
+      return ascii.substr((ascii.size() - length) / 2, length);
+    case lidx_search_kind_suffix:
+      return ascii.substr(ascii.size() - length, length);
+  }
+  return ascii;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: lidx_bench [-d docs] [-w words_per_doc] [-v vocabulary] [-q queries] [-r removals] [-c cache_mb] [-j threads] [-t timeout_ms] [-m] [-s seed] [-p index_path] [-o output.json]\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char ** argv)
+{
+  bench_config config;
+  config.docs_count = 10000;
+  config.words_per_doc = 50;
+  config.vocabulary_size = 50000;
+  config.queries_count = 200;
+  config.removals_count = 1000;
+  config.query_cache_mb = 0;
+  config.search_threads = 0;
+  config.search_timeout_ms = 0;
+  config.in_memory = 0;
+  config.seed = 42;
+  config.index_path = "lidx_bench.lidx";
+  config.output_path = NULL;
+
+  int ch;
+  while ((ch = getopt(argc, argv, "d:w:v:q:r:c:j:t:ms:p:o:")) != -1) {
+    switch (ch) {
+      case 'd':
+        config.docs_count = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+      case 'w':
+        config.words_per_doc = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+      case 'v':
+        config.vocabulary_size = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+      case 'q':
+        config.queries_count = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        config.removals_count = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+      case 'c':
+        config.query_cache_mb = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+      case 'j':
+        config.search_threads = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        config.search_timeout_ms = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+      case 'm':
+        config.in_memory = 1;
+        break;
+      case 's':
+        config.seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'p':
+        config.index_path = optarg;
+        break;
+      case 'o':
+        config.output_path = optarg;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (config.vocabulary_size == 0) {
+    usage();
+  }
+
+  uint64_t state = config.seed;
+  bench_corpus corpus;
+  bench_generate_vocabulary(&corpus, config.vocabulary_size, &state);
+  std::vector<std::string> documents;
+  uint64_t corpus_bytes = 0;
+  for(unsigned int i = 0 ; i < config.docs_count ; i ++) {
+    documents.push_back(bench_generate_document(&corpus, config.words_per_doc, &state));
+    corpus_bytes += documents[i].size();
+  }
+
+  lidx * index = lidx_new();
+  lidx_set_query_cache_size(index, (size_t) config.query_cache_mb * 1024 * 1024);
+  lidx_set_search_threads(index, config.search_threads);
+  if (config.in_memory) {
+    lidx_open_memory(index);
+  }
+  else {
+    if (bench_remove_index(config.index_path) < 0) {
+      fprintf(stderr, "lidx_bench: %s is not an index, it won't be replaced\n", config.index_path);
+      return EXIT_FAILURE;
+    }
+    if (lidx_open(index, config.index_path) < 0) {
+      fprintf(stderr, "lidx_bench: could not open %s\n", config.index_path);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Indexing.
+  double start = bench_now();
+  for(unsigned int i = 0 ; i < config.docs_count ; i ++) {
+    lidx_set(index, i, documents[i].c_str());
+  }
+  double index_duration = bench_now() - start;
+  start = bench_now();
+  lidx_flush(index);
+  double flush_duration = bench_now() - start;
+
+  // Searches.
+  const char * kinds_names[] = { "prefix", "substr", "suffix" };
+  std::vector<double> latencies[3];
+  uint64_t results_count[3] = { 0, 0, 0 };
+  unsigned int truncated_count[3] = { 0, 0, 0 };
+  for(int kind = 0 ; kind < 3 ; kind ++) {
+    unsigned int done = 0;
+    unsigned int tries = 0;
+    while ((done < config.queries_count) && (tries < config.queries_count * 100)) {
+      tries ++;
+      const bench_word & word = bench_pick_word(&corpus, &state);
+      if (word.ascii.size() == 0) {
+        continue;
+      }
+      std::string token = bench_query_token(word, (lidx_search_kind) kind);
+      uint64_t * docsids;
+      size_t count;
+      start = bench_now();
+      if (config.search_timeout_ms > 0) {
+        int truncated;
+        lidx_search_handle * search = lidx_search_start(index, token.c_str(), (lidx_search_kind) kind,
+          config.search_timeout_ms, NULL, NULL);
+        lidx_search_finish(search, &docsids, &count, &truncated);
+        truncated_count[kind] += truncated;
+      }
+      else {
+        lidx_search(index, token.c_str(), (lidx_search_kind) kind, &docsids, &count);
+      }
+      latencies[kind].push_back(bench_now() - start);
+      free(docsids);
+      results_count[kind] += count;
+      done ++;
+    }
+  }
+
+  // Removals.
+  unsigned int removals_count = std::min(config.removals_count, config.docs_count);
+  start = bench_now();
+  for(unsigned int i = 0 ; i < removals_count ; i ++) {
+    lidx_remove(index, bench_random(&state) % config.docs_count);
+  }
+  lidx_flush(index);
+  double remove_duration = bench_now() - start;
+
+  lidx_close(index);
+  lidx_free(index);
+  uint64_t disk_size = 0;
+  if (!config.in_memory) {
+    disk_size = bench_disk_size(config.index_path);
+  }
+
+  FILE * output = stdout;
+  if (config.output_path != NULL) {
+    output = fopen(config.output_path, "w");
+    if (output == NULL) {
+      perror(config.output_path);
+      return EXIT_FAILURE;
+    }
+  }
+  fprintf(output, "{\n");
+  fprintf(output, "  \"config\": {\"docs\": %u, \"words_per_doc\": %u, \"vocabulary\": %u, \"queries\": %u, \"removals\": %u, \"query_cache_mb\": %u, \"search_threads\": %u, \"search_timeout_ms\": %u, \"in_memory\": %d, \"seed\": %llu},\n",
+    config.docs_count, config.words_per_doc, config.vocabulary_size, config.queries_count, removals_count,
+    config.query_cache_mb, config.search_threads, config.search_timeout_ms, config.in_memory,
+    (unsigned long long) config.seed);
+  fprintf(output, "  \"index\": {\"seconds\": %.6f, \"docs_per_second\": %.1f, \"mb_per_second\": %.3f},\n",
+    index_duration,
+    (index_duration > 0) ? config.docs_count / index_duration : 0,
+    (index_duration > 0) ? corpus_bytes / index_duration / (1024 * 1024) : 0);
+  fprintf(output, "  \"flush\": {\"seconds\": %.6f},\n", flush_duration);
+  fprintf(output, "  \"remove\": {\"seconds\": %.6f, \"ops_per_second\": %.1f},\n",
+    remove_duration, (remove_duration > 0) ? removals_count / remove_duration : 0);
+  fprintf(output, "  \"search\": {\n");
+  for(int kind = 0 ; kind < 3 ; kind ++) {
+    size_t count = latencies[kind].size();
+    fprintf(output, "    \"%s\": {\"p50_us\": %.1f, \"p99_us\": %.1f, \"avg_results\": %.1f, \"truncated\": %u}%s\n",
+      kinds_names[kind],
+      bench_percentile(latencies[kind], 0.50) * 1e6,
+      bench_percentile(latencies[kind], 0.99) * 1e6,
+      (count > 0) ? (double) results_count[kind] / count : 0,
+      truncated_count[kind],
+      (kind < 2) ? "," : "");
+  }
+  fprintf(output, "  },\n");
+  fprintf(output, "  \"disk\": {\"bytes\": %llu, \"corpus_bytes\": %llu},\n",
+    (unsigned long long) disk_size, (unsigned long long) corpus_bytes);
+  lidx_stats stats;
+  lidx_get_stats(&stats);
+  fprintf(output, "  \"stats\": {\"get_buffer_hits\": %llu, \"get_buffer_misses\": %llu, \"flush_keys\": %llu, \"flush_bytes\": %llu, \"tokens\": %llu, \"search_keys_scanned\": %llu, \"search_keys_matched\": %llu, \"icu_calls\": %llu, \"icu_seconds\": %.6f, \"query_cache_hits\": %llu, \"query_cache_misses\": %llu}\n",
+    (unsigned long long) stats.get_buffer_hits, (unsigned long long) stats.get_buffer_misses,
+    (unsigned long long) stats.flush_keys, (unsigned long long) stats.flush_bytes,
+    (unsigned long long) stats.tokens_count,
+    (unsigned long long) stats.search_keys_scanned, (unsigned long long) stats.search_keys_matched,
+    (unsigned long long) stats.icu_calls, stats.icu_time_ns / 1e9,
+    (unsigned long long) stats.query_cache_hits, (unsigned long long) stats.query_cache_misses);
+  fprintf(output, "}\n");
+  if (output != stdout) {
+    fclose(output);
+  }
+
+  return EXIT_SUCCESS;
+}
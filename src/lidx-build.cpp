@@ -0,0 +1,115 @@
+// lidx-build: builds an index from a corpus dump.
+//
+// Each line of the corpus is a document: the document identifier, a tab
+// and the UTF-8 content of the document.
+//
+// usage: lidx-build [-n] [-l] [-m memory_mb] [-t tmpdir] corpus.txt index.lidx
+// -n: disable tokenization, the content of each document is a single word.
+// -l: lowercase the words instead of transliterating them.
+// -m: memory used to sort words before spilling them to disk, in MB.
+// -t: directory where to store the sorted runs.
+// Use "-" to read the corpus from the standard input.
+
+#include "lidx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: lidx-build [-n] [-l] [-m memory_mb] [-t tmpdir] corpus.txt index.lidx\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char ** argv)
+{
+  int tokenize_enabled = 1;
+  lidx_normalization normalization = lidx_normalization_transliterate;
+  size_t memory_limit = 0;
+  const char * tmpdir = NULL;
+  int ch;
+  
+  while ((ch = getopt(argc, argv, "nlm:t:")) != -1) {
+    switch (ch) {
+      case 'n':
+        tokenize_enabled = 0;
+        break;
+      case 'l':
+        normalization = lidx_normalization_lowercase;
+        break;
+      case 'm':
+        memory_limit = (size_t) strtoull(optarg, NULL, 10) * 1024 * 1024;
+        break;
+      case 't':
+        tmpdir = optarg;
+        break;
+      default:
+        usage();
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc != 2) {
+    usage();
+  }
+  
+  FILE * corpus = stdin;
+  if (strcmp(argv[0], "-") != 0) {
+    corpus = fopen(argv[0], "rb");
+    if (corpus == NULL) {
+      perror(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  
+  lidx_bulk * bulk = lidx_bulk_new();
+  if (memory_limit != 0) {
+    lidx_bulk_set_memory_limit(bulk, memory_limit);
+  }
+  lidx_bulk_set_normalization(bulk, normalization);
+  if (lidx_bulk_open(bulk, argv[1], tmpdir) < 0) {
+    fprintf(stderr, "lidx-build: could not create %s\n", argv[1]);
+    lidx_bulk_free(bulk);
+    return EXIT_FAILURE;
+  }
+  
+  int result = EXIT_SUCCESS;
+  char * line = NULL;
+  size_t line_capacity = 0;
+  ssize_t line_length;
+  unsigned long long line_number = 0;
+  while ((line_length = getline(&line, &line_capacity, corpus)) != -1) {
+    line_number ++;
+    if ((line_length > 0) && (line[line_length - 1] == '\n')) {
+      line[line_length - 1] = 0;
+    }
+    char * text = strchr(line, '\t');
+    if (text == NULL) {
+      fprintf(stderr, "lidx-build: line %llu: missing tab\n", line_number);
+      result = EXIT_FAILURE;
+      break;
+    }
+    * text = 0;
+    text ++;
+    uint64_t doc = strtoull(line, NULL, 10);
+    if (lidx_bulk_set2(bulk, doc, text, tokenize_enabled) < 0) {
+      fprintf(stderr, "lidx-build: line %llu: could not add document\n", line_number);
+      result = EXIT_FAILURE;
+      break;
+    }
+  }
+  free(line);
+  if (corpus != stdin) {
+    fclose(corpus);
+  }
+  
+  if (lidx_bulk_close(bulk) < 0) {
+    fprintf(stderr, "lidx-build: could not write %s\n", argv[1]);
+    result = EXIT_FAILURE;
+  }
+  lidx_bulk_free(bulk);
+  
+  return result;
+}
@@ -0,0 +1,721 @@
+#include "lidx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lidx-utils.h"
+#include "lidx-icu-utils.h"
+#include "lidx-encode.h"
+#include "lidx-keys.h"
+#include "lidx-tokenizer.h"
+#include "lidx-complete.h"
+#include "lidx-storage.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// The index is built in four passes:
+// 1. documents are tokenized and (word, document) pairs are sorted in memory
+//    and spilled to disk in sorted runs.
+// 2. the runs are merged. The posting list of each word is written to a
+//    temporary file in word order. The first occurrence of each word is
+//    kept in memory to assign words ids in the same order as `lidx_set()`.
+// 3. words and /[word id] entries are written to the index and
+//    (document, word id) pairs are sorted. Documents without words are
+//    added to this sort during pass 1.
+// 4. ,[docid] entries are written to the index.
+//
+// The sequence number of a document is its position in the corpus. Posting
+// lists are sorted by sequence number to get the same order as `lidx_set()`.
+// Entries are written in large batches through `lidx_storage`.
+
+#define BULK_DEFAULT_MEMORY_LIMIT (64 * 1024 * 1024)
+// Rough memory overhead of a record in the sort buffer.
+#define BULK_RECORD_OVERHEAD 64
+#define BULK_BATCH_SIZE (4 * 1024 * 1024)
+
+struct bulk_record {
+  std::string key;
+  std::string value;
+  size_t run;
+};
+
+struct bulk_record_less {
+  bool operator()(const bulk_record & a, const bulk_record & b) const {
+    return a.key < b.key;
+  }
+};
+
+struct bulk_record_greater {
+  bool operator()(const bulk_record & a, const bulk_record & b) const {
+    return a.key > b.key;
+  }
+};
+
+// External sorter of (key, value) records. Keys are compared bytewise.
+struct bulk_sorter {
+  std::string tmpdir;
+  size_t memory_limit;
+  std::vector<bulk_record> buffer;
+  size_t buffer_size;
+  std::vector<FILE *> runs;
+  // merge state.
+  size_t buffer_position;
+  std::vector<bulk_record> heap;
+};
+
+struct lidx_bulk {
+  lidx_storage * bulk_db;
+  size_t bulk_memory_limit;
+  std::string * bulk_tmpdir;
+  bulk_sorter * bulk_words_sorter;
+  bulk_sorter * bulk_docs_sorter;
+  uint64_t bulk_docseq;
+  lidx_normalization bulk_normalization;
+};
+
+static FILE * bulk_tmpfile(const std::string & tmpdir);
+static int bulk_write_record(FILE * f, const std::string & key, const std::string & value);
+static int bulk_read_record(FILE * f, std::string * p_key, std::string * p_value);
+static void bulk_encode_be64(std::string & buffer, uint64_t value);
+static uint64_t bulk_decode_be64(const std::string & buffer, size_t position);
+
+static bulk_sorter * bulk_sorter_new(const std::string & tmpdir, size_t memory_limit);
+static void bulk_sorter_free(bulk_sorter * sorter);
+static int bulk_sorter_add(bulk_sorter * sorter, const std::string & key, const std::string & value);
+static int bulk_sorter_start(bulk_sorter * sorter);
+static int bulk_sorter_next(bulk_sorter * sorter, std::string * p_key, std::string * p_value);
+
+lidx_bulk * lidx_bulk_new(void)
+{
+  lidx_init_icu_utils();
+  lidx_bulk * result = (lidx_bulk *) calloc(1, sizeof(* result));
+  result->bulk_memory_limit = BULK_DEFAULT_MEMORY_LIMIT;
+  result->bulk_tmpdir = new std::string();
+  return result;
+}
+
+void lidx_bulk_free(lidx_bulk * bulk)
+{
+  if (bulk->bulk_words_sorter != NULL) {
+    bulk_sorter_free(bulk->bulk_words_sorter);
+  }
+  if (bulk->bulk_docs_sorter != NULL) {
+    bulk_sorter_free(bulk->bulk_docs_sorter);
+  }
+  delete bulk->bulk_db;
+  delete bulk->bulk_tmpdir;
+  free(bulk);
+}
+
+void lidx_bulk_set_memory_limit(lidx_bulk * bulk, size_t memory_limit)
+{
+  bulk->bulk_memory_limit = memory_limit;
+}
+
+void lidx_bulk_set_normalization(lidx_bulk * bulk, lidx_normalization normalization)
+{
+  bulk->bulk_normalization = normalization;
+}
+
+int lidx_bulk_open(lidx_bulk * bulk, const char * filename, const char * tmpdir)
+{
+  if (tmpdir == NULL) {
+    tmpdir = getenv("TMPDIR");
+  }
+  if (tmpdir == NULL) {
+    tmpdir = "/tmp";
+  }
+  bulk->bulk_tmpdir->assign(tmpdir);
+
+  bulk->bulk_db = lidx_storage_leveldb_create(filename);
+  if (bulk->bulk_db == NULL) {
+    return -1;
+  }
+  bulk->bulk_words_sorter = bulk_sorter_new(* bulk->bulk_tmpdir, bulk->bulk_memory_limit);
+  bulk->bulk_docs_sorter = bulk_sorter_new(* bulk->bulk_tmpdir, bulk->bulk_memory_limit);
+
+  return 0;
+}
+
+//int lidx_bulk_set2(lidx_bulk * bulk, uint64_t doc, const char * text, int tokenize_enabled);
+// text -> transliterated words -> (word, docseq) -> (first position in document, doc)
+
+struct bulk_tokenize_context {
+  lidx_bulk * bulk;
+  uint64_t doc;
+  std::set<std::string> * words;
+};
+
+static int bulk_tokenize_callback(const char * word, void * context);
+static int bulk_set_document(lidx_bulk * bulk, uint64_t doc, const char * text, const UChar * utext,
+    int tokenize_enabled);
+
+int lidx_bulk_set2(lidx_bulk * bulk, uint64_t doc, const char * text, int tokenize_enabled)
+{
+  return bulk_set_document(bulk, doc, text, NULL, tokenize_enabled);
+}
+
+int lidx_bulk_u_set2(lidx_bulk * bulk, uint64_t doc, const UChar * utext, int tokenize_enabled)
+{
+  return bulk_set_document(bulk, doc, NULL, utext, tokenize_enabled);
+}
+
+// Either `text` (UTF-8) or `utext` (UTF-16) is set.
+static int bulk_set_document(lidx_bulk * bulk, uint64_t doc, const char * text, const UChar * utext,
+    int tokenize_enabled)
+{
+  std::set<std::string> words;
+  struct bulk_tokenize_context context;
+  context.bulk = bulk;
+  context.doc = doc;
+  context.words = &words;
+  int r;
+  if (text != NULL) {
+    r = lidx_tokenize_utf8(text, tokenize_enabled, bulk->bulk_normalization, bulk_tokenize_callback, &context);
+  }
+  else {
+    r = lidx_tokenize(utext, tokenize_enabled, bulk->bulk_normalization, bulk_tokenize_callback, &context);
+  }
+  if (r < 0) {
+    return r;
+  }
+  if (words.size() == 0) {
+    // The document still needs an empty ,[docid] entry.
+    std::string key;
+    bulk_encode_be64(key, doc);
+    bulk_encode_be64(key, bulk->bulk_docseq);
+    r = bulk_sorter_add(bulk->bulk_docs_sorter, key, std::string());
+    if (r < 0) {
+      return r;
+    }
+  }
+  bulk->bulk_docseq ++;
+  return 0;
+}
+
+static int bulk_tokenize_callback(const char * word, void * context)
+{
+  struct bulk_tokenize_context * bulk_context = (struct bulk_tokenize_context *) context;
+  std::string word_str(word);
+  if (bulk_context->words->find(word_str) != bulk_context->words->end()) {
+    return 0;
+  }
+  uint64_t position = bulk_context->words->size();
+  bulk_context->words->insert(word_str);
+
+  std::string key(word_str);
+  key.push_back(0);
+  bulk_encode_be64(key, bulk_context->bulk->bulk_docseq);
+  std::string value;
+  lidx_encode_uint64(value, position);
+  lidx_encode_uint64(value, bulk_context->doc);
+  return bulk_sorter_add(bulk_context->bulk->bulk_words_sorter, key, value);
+}
+
+//int lidx_bulk_close(lidx_bulk * bulk);
+// merge (word, docseq) -> word -> [word id], [docs ids]
+//                      -> /[word id] -> word
+//                      -> (doc, docseq, word id) -> ,[docid] -> [words ids]
+
+struct bulk_word_order {
+  uint64_t docseq;
+  uint64_t position;
+  uint64_t ordinal;
+};
+
+struct bulk_word_order_less {
+  bool operator()(const bulk_word_order & a, const bulk_word_order & b) const {
+    if (a.docseq != b.docseq) {
+      return a.docseq < b.docseq;
+    }
+    return a.position < b.position;
+  }
+};
+
+static int bulk_merge_words(lidx_bulk * bulk, FILE * words_file, std::vector<uint64_t> & wordsids);
+static int bulk_write_words(lidx_bulk * bulk, FILE * words_file, std::vector<uint64_t> & wordsids);
+static int bulk_write_docs(lidx_bulk * bulk);
+static int bulk_write_batch(lidx_bulk * bulk, lidx_storage_batch * batch, int force);
+
+int lidx_bulk_close(lidx_bulk * bulk)
+{
+  if (bulk->bulk_db == NULL) {
+    return -1;
+  }
+  
+  int result = 0;
+  std::vector<uint64_t> wordsids;
+  FILE * words_file = bulk_tmpfile(* bulk->bulk_tmpdir);
+  if (words_file == NULL) {
+    result = -1;
+    goto close_db;
+  }
+  if (bulk_merge_words(bulk, words_file, wordsids) < 0) {
+    result = -1;
+    goto close_words_file;
+  }
+  if (bulk_write_words(bulk, words_file, wordsids) < 0) {
+    result = -1;
+    goto close_words_file;
+  }
+  if (bulk_write_docs(bulk) < 0) {
+    result = -1;
+    goto close_words_file;
+  }
+  
+  close_words_file:
+  fclose(words_file);
+  close_db:
+  bulk_sorter_free(bulk->bulk_words_sorter);
+  bulk->bulk_words_sorter = NULL;
+  bulk_sorter_free(bulk->bulk_docs_sorter);
+  bulk->bulk_docs_sorter = NULL;
+  delete bulk->bulk_db;
+  bulk->bulk_db = NULL;
+  return result;
+}
+
+// Pass 2: merges the runs and writes the posting lists to `words_file`.
+// Records of `words_file` are: word -> [docs ids and docs seqs].
+// Words ids are stored in `wordsids`, in the order of `words_file`.
+static int bulk_merge_words(lidx_bulk * bulk, FILE * words_file, std::vector<uint64_t> & wordsids)
+{
+  std::vector<bulk_word_order> order;
+  std::string current_word;
+  std::string postings;
+  int has_word = 0;
+  std::string key;
+  std::string value;
+  
+  if (bulk_sorter_start(bulk->bulk_words_sorter) < 0) {
+    return -1;
+  }
+  while (1) {
+    int r = bulk_sorter_next(bulk->bulk_words_sorter, &key, &value);
+    if (r < 0) {
+      return -1;
+    }
+    
+    std::string word;
+    if (r > 0) {
+      word = key.substr(0, key.size() - 9);
+    }
+    if (has_word && ((r == 0) || (word != current_word))) {
+      if (bulk_write_record(words_file, current_word, postings) < 0) {
+        return -1;
+      }
+      has_word = 0;
+    }
+    if (r == 0) {
+      break;
+    }
+    
+    uint64_t docseq = bulk_decode_be64(key, key.size() - 8);
+    uint64_t position;
+    uint64_t doc;
+    size_t value_position = 0;
+    value_position = lidx_decode_uint64(value, value_position, &position);
+    value_position = lidx_decode_uint64(value, value_position, &doc);
+    if (!has_word) {
+      // First occurrence of the word in the corpus.
+      bulk_word_order word_order;
+      word_order.docseq = docseq;
+      word_order.position = position;
+      word_order.ordinal = order.size();
+      order.push_back(word_order);
+      current_word = word;
+      postings.clear();
+      has_word = 1;
+    }
+    lidx_encode_uint64(postings, doc);
+    lidx_encode_uint64(postings, docseq);
+  }
+  
+  // Words ids are assigned in the order of first occurrence.
+  std::sort(order.begin(), order.end(), bulk_word_order_less());
+  wordsids.resize(order.size());
+  for(size_t i = 0 ; i < order.size() ; i ++) {
+    wordsids[order[i].ordinal] = i;
+  }
+  
+  return 0;
+}
+
+// Pass 3: writes word, /[word id] and completion entries.
+static int bulk_write_words(lidx_bulk * bulk, FILE * words_file, std::vector<uint64_t> & wordsids)
+{
+  lidx_storage_batch batch;
+  lidx_storage_batch_init(&batch);
+  std::string word;
+  std::string postings;
+  size_t ordinal = 0;
+  lidx_complete_builder builder;
+  
+  rewind(words_file);
+  while (1) {
+    int r = bulk_read_record(words_file, &word, &postings);
+    if (r < 0) {
+      return -1;
+    }
+    if (r == 0) {
+      break;
+    }
+    
+    uint64_t wordid = wordsids[ordinal];
+    ordinal ++;
+    std::string value_str;
+    lidx_encode_uint64(value_str, wordid);
+    size_t position = 0;
+    uint64_t frequency = 0;
+    while (position < postings.size()) {
+      uint64_t doc;
+      uint64_t docseq;
+      position = lidx_decode_uint64(postings, position, &doc);
+      position = lidx_decode_uint64(postings, position, &docseq);
+      lidx_encode_uint64(value_str, doc);
+      
+      std::string doc_key;
+      bulk_encode_be64(doc_key, doc);
+      bulk_encode_be64(doc_key, docseq);
+      bulk_encode_be64(doc_key, wordid);
+      if (bulk_sorter_add(bulk->bulk_docs_sorter, doc_key, std::string()) < 0) {
+        return -1;
+      }
+      frequency ++;
+    }
+    std::string word_key;
+    lidx_word_key(word_key, word);
+    lidx_storage_batch_put(&batch, word_key, value_str);
+    
+    std::string frequency_key;
+    std::string frequency_value;
+    lidx_complete_frequency_key(frequency_key, word);
+    lidx_encode_uint64(frequency_value, frequency);
+    lidx_storage_batch_put(&batch, frequency_key, frequency_value);
+    lidx_complete_builder_add(&builder, word, frequency);
+    
+    std::string key("/");
+    lidx_encode_uint64(key, wordid);
+    lidx_storage_batch_put(&batch, key, word);
+    
+    if (bulk_write_batch(bulk, &batch, 0) < 0) {
+      return -1;
+    }
+  }
+  
+  std::string normalization_key;
+  std::string normalization_value;
+  lidx_metadata_key(normalization_key, LIDX_METADATA_NORMALIZATION);
+  lidx_encode_uint64(normalization_value, bulk->bulk_normalization);
+  lidx_storage_batch_put(&batch, normalization_key, normalization_value);
+  
+  if (wordsids.size() > 0) {
+    std::string nextwordidkey(".");
+    std::string value;
+    lidx_encode_uint64(value, wordsids.size());
+    lidx_storage_batch_put(&batch, nextwordidkey, value);
+    
+    for(std::map<std::string, lidx_complete_list>::iterator lists_iterator = builder.lists.begin() ; lists_iterator != builder.lists.end() ; ++ lists_iterator) {
+      std::string list_key;
+      std::string list_value;
+      lidx_complete_list_key(list_key, lists_iterator->first);
+      lidx_complete_list_encode(list_value, lists_iterator->second);
+      lidx_storage_batch_put(&batch, list_key, list_value);
+      if (bulk_write_batch(bulk, &batch, 0) < 0) {
+        return -1;
+      }
+    }
+  }
+  
+  return bulk_write_batch(bulk, &batch, 1);
+}
+
+// Pass 4: writes ,[docid] entries.
+static int bulk_write_docs(lidx_bulk * bulk)
+{
+  lidx_storage_batch batch;
+  lidx_storage_batch_init(&batch);
+  std::string key;
+  std::string value;
+  std::string value_str;
+  uint64_t current_doc = 0;
+  uint64_t current_docseq = 0;
+  int has_doc = 0;
+  
+  if (bulk_sorter_start(bulk->bulk_docs_sorter) < 0) {
+    return -1;
+  }
+  while (1) {
+    int r = bulk_sorter_next(bulk->bulk_docs_sorter, &key, &value);
+    if (r < 0) {
+      return -1;
+    }
+    
+    uint64_t doc = 0;
+    uint64_t docseq = 0;
+    if (r > 0) {
+      doc = bulk_decode_be64(key, 0);
+      docseq = bulk_decode_be64(key, 8);
+    }
+    if (has_doc && ((r == 0) || (doc != current_doc))) {
+      std::string doc_key(",");
+      lidx_encode_uint64(doc_key, current_doc);
+      lidx_storage_batch_put(&batch, doc_key, value_str);
+      if (bulk_write_batch(bulk, &batch, 0) < 0) {
+        return -1;
+      }
+      has_doc = 0;
+    }
+    if (r == 0) {
+      break;
+    }
+    
+    if (!has_doc) {
+      current_doc = doc;
+      current_docseq = docseq;
+      value_str.clear();
+      has_doc = 1;
+    }
+    else if (docseq != current_docseq) {
+      // The document has been added twice.
+      return -1;
+    }
+    if (key.size() > 16) {
+      lidx_encode_uint64(value_str, bulk_decode_be64(key, 16));
+    }
+  }
+  
+  return bulk_write_batch(bulk, &batch, 1);
+}
+
+static int bulk_write_batch(lidx_bulk * bulk, lidx_storage_batch * batch, int force)
+{
+  if (!force && (batch->size < BULK_BATCH_SIZE)) {
+    return 0;
+  }
+  if (bulk->bulk_db->write(batch) < 0) {
+    return -1;
+  }
+  lidx_storage_batch_init(batch);
+  return 0;
+}
+
+// External sorter.
+
+static bulk_sorter * bulk_sorter_new(const std::string & tmpdir, size_t memory_limit)
+{
+  bulk_sorter * sorter = new bulk_sorter();
+  sorter->tmpdir = tmpdir;
+  sorter->memory_limit = memory_limit;
+  sorter->buffer_size = 0;
+  sorter->buffer_position = 0;
+  return sorter;
+}
+
+static void bulk_sorter_free(bulk_sorter * sorter)
+{
+  for(size_t i = 0 ; i < sorter->runs.size() ; i ++) {
+    fclose(sorter->runs[i]);
+  }
+  delete sorter;
+}
+
+static int bulk_sorter_spill(bulk_sorter * sorter)
+{
+  std::sort(sorter->buffer.begin(), sorter->buffer.end(), bulk_record_less());
+  FILE * f = bulk_tmpfile(sorter->tmpdir);
+  if (f == NULL) {
+    return -1;
+  }
+  sorter->runs.push_back(f);
+  for(size_t i = 0 ; i < sorter->buffer.size() ; i ++) {
+    if (bulk_write_record(f, sorter->buffer[i].key, sorter->buffer[i].value) < 0) {
+      return -1;
+    }
+  }
+  sorter->buffer.clear();
+  sorter->buffer_size = 0;
+  return 0;
+}
+
+static int bulk_sorter_add(bulk_sorter * sorter, const std::string & key, const std::string & value)
+{
+  bulk_record record;
+  record.key = key;
+  record.value = value;
+  record.run = 0;
+  sorter->buffer.push_back(record);
+  sorter->buffer_size += key.size() + value.size() + BULK_RECORD_OVERHEAD;
+  if (sorter->buffer_size >= sorter->memory_limit) {
+    return bulk_sorter_spill(sorter);
+  }
+  return 0;
+}
+
+static int bulk_sorter_start(bulk_sorter * sorter)
+{
+  if (sorter->runs.size() == 0) {
+    // Everything fits in memory.
+    std::sort(sorter->buffer.begin(), sorter->buffer.end(), bulk_record_less());
+    sorter->buffer_position = 0;
+    return 0;
+  }
+  
+  if (sorter->buffer.size() > 0) {
+    if (bulk_sorter_spill(sorter) < 0) {
+      return -1;
+    }
+  }
+  for(size_t i = 0 ; i < sorter->runs.size() ; i ++) {
+    rewind(sorter->runs[i]);
+    bulk_record record;
+    int r = bulk_read_record(sorter->runs[i], &record.key, &record.value);
+    if (r < 0) {
+      return -1;
+    }
+    if (r == 0) {
+      continue;
+    }
+    record.run = i;
+    sorter->heap.push_back(record);
+  }
+  std::make_heap(sorter->heap.begin(), sorter->heap.end(), bulk_record_greater());
+  return 0;
+}
+
+// Returns 1 if a record was read, 0 at the end of the records, -1 on error.
+static int bulk_sorter_next(bulk_sorter * sorter, std::string * p_key, std::string * p_value)
+{
+  if (sorter->runs.size() == 0) {
+    if (sorter->buffer_position >= sorter->buffer.size()) {
+      return 0;
+    }
+    p_key->swap(sorter->buffer[sorter->buffer_position].key);
+    p_value->swap(sorter->buffer[sorter->buffer_position].value);
+    sorter->buffer_position ++;
+    return 1;
+  }
+  
+  if (sorter->heap.size() == 0) {
+    return 0;
+  }
+  std::pop_heap(sorter->heap.begin(), sorter->heap.end(), bulk_record_greater());
+  bulk_record & record = sorter->heap.back();
+  p_key->swap(record.key);
+  p_value->swap(record.value);
+  int r = bulk_read_record(sorter->runs[record.run], &record.key, &record.value);
+  if (r < 0) {
+    return -1;
+  }
+  if (r == 0) {
+    sorter->heap.pop_back();
+  }
+  else {
+    std::push_heap(sorter->heap.begin(), sorter->heap.end(), bulk_record_greater());
+  }
+  return 1;
+}
+
+// Temporary files.
+
+static FILE * bulk_tmpfile(const std::string & tmpdir)
+{
+  std::string path = tmpdir + "/lidx-bulk-XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd == -1) {
+    return NULL;
+  }
+  // The file is removed when closed.
+  unlink(path.c_str());
+  FILE * f = fdopen(fd, "w+b");
+  if (f == NULL) {
+    close(fd);
+    return NULL;
+  }
+  return f;
+}
+
+static int bulk_write_record(FILE * f, const std::string & key, const std::string & value)
+{
+  std::string header;
+  lidx_encode_uint64(header, key.size());
+  lidx_encode_uint64(header, value.size());
+  if (fwrite(header.data(), 1, header.size(), f) != header.size()) {
+    return -1;
+  }
+  if (fwrite(key.data(), 1, key.size(), f) != key.size()) {
+    return -1;
+  }
+  if (fwrite(value.data(), 1, value.size(), f) != value.size()) {
+    return -1;
+  }
+  return 0;
+}
+
+// Returns 1 if a varint was read, 0 at the end of the file, -1 on error.
+static int bulk_read_uint64(FILE * f, uint64_t * p_value)
+{
+  uint64_t value = 0;
+  int s = 0;
+  
+  while (1) {
+    int c = getc(f);
+    if (c == EOF) {
+      return (s == 0) ? 0 : -1;
+    }
+    value += ((uint64_t) c & 0x7f) << s;
+    if ((c & 0x80) == 0) {
+      break;
+    }
+    s += 7;
+  }
+  
+  * p_value = value;
+  return 1;
+}
+
+// Returns 1 if a record was read, 0 at the end of the file, -1 on error.
+static int bulk_read_record(FILE * f, std::string * p_key, std::string * p_value)
+{
+  uint64_t key_size;
+  uint64_t value_size;
+  int r = bulk_read_uint64(f, &key_size);
+  if (r <= 0) {
+    return r;
+  }
+  if (bulk_read_uint64(f, &value_size) <= 0) {
+    return -1;
+  }
+  p_key->resize(key_size);
+  p_value->resize(value_size);
+  if ((key_size > 0) && (fread(&(* p_key)[0], 1, key_size, f) != key_size)) {
+    return -1;
+  }
+  if ((value_size > 0) && (fread(&(* p_value)[0], 1, value_size, f) != value_size)) {
+    return -1;
+  }
+  return 1;
+}
+
+static void bulk_encode_be64(std::string & buffer, uint64_t value)
+{
+  char valuestr[8];
+  for(int i = 0 ; i < 8 ; i ++) {
+    valuestr[i] = (char) ((value >> (56 - i * 8)) & 0xff);
+  }
+  buffer.append(valuestr, 8);
+}
+
+static uint64_t bulk_decode_be64(const std::string & buffer, size_t position)
+{
+  uint64_t value = 0;
+  for(int i = 0 ; i < 8 ; i ++) {
+    value = (value << 8) | (unsigned char) buffer[position + i];
+  }
+  return value;
+}
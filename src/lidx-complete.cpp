@@ -0,0 +1,147 @@
+#include "lidx-complete.h"
+
+#include "lidx-encode.h"
+#include "lidx-keys.h"
+
+void lidx_complete_frequency_key(std::string & key, const std::string & word)
+{
+  lidx_metadata_key(key, LIDX_METADATA_FREQUENCY);
+  key.append(word);
+}
+
+void lidx_complete_list_key(std::string & key, const std::string & prefix)
+{
+  lidx_metadata_key(key, LIDX_METADATA_COMPLETION);
+  key.append(prefix);
+}
+
+static inline int is_utf8_continuation(char c)
+{
+  return ((unsigned char) c & 0xc0) == 0x80;
+}
+
+void lidx_complete_short_prefixes(const std::string & word, std::vector<std::string> * p_prefixes)
+{
+  p_prefixes->push_back(std::string());
+  size_t position = 0;
+  for(int length = 1 ; length <= LIDX_COMPLETE_SHORT_PREFIX_LENGTH ; length ++) {
+    if (position >= word.size()) {
+      break;
+    }
+    position ++;
+    while ((position < word.size()) && is_utf8_continuation(word[position])) {
+      position ++;
+    }
+    p_prefixes->push_back(word.substr(0, position));
+  }
+}
+
+int lidx_complete_is_short_prefix(const std::string & prefix)
+{
+  int length = 0;
+  for(size_t i = 0 ; i < prefix.size() ; i ++) {
+    if (!is_utf8_continuation(prefix[i])) {
+      length ++;
+    }
+  }
+  return length <= LIDX_COMPLETE_SHORT_PREFIX_LENGTH;
+}
+
+void lidx_complete_list_init(lidx_complete_list * list)
+{
+  list->floor = 0;
+  list->entries.clear();
+}
+
+void lidx_complete_list_encode(std::string & buffer, const lidx_complete_list & list)
+{
+  lidx_encode_uint64(buffer, list.floor);
+  for(size_t i = 0 ; i < list.entries.size() ; i ++) {
+    lidx_encode_uint64(buffer, list.entries[i].frequency);
+    lidx_encode_uint64(buffer, list.entries[i].word.size());
+    buffer.append(list.entries[i].word);
+  }
+}
+
+void lidx_complete_list_decode(std::string & buffer, lidx_complete_list * p_list)
+{
+  lidx_complete_list_init(p_list);
+  size_t position = 0;
+  position = lidx_decode_uint64(buffer, position, &p_list->floor);
+  while (position < buffer.size()) {
+    lidx_complete_entry entry;
+    uint64_t length;
+    position = lidx_decode_uint64(buffer, position, &entry.frequency);
+    position = lidx_decode_uint64(buffer, position, &length);
+    entry.word = buffer.substr(position, length);
+    position += length;
+    p_list->entries.push_back(entry);
+  }
+}
+
+static inline bool entry_less(const lidx_complete_entry & a, const lidx_complete_entry & b)
+{
+  if (a.frequency != b.frequency) {
+    return a.frequency > b.frequency;
+  }
+  return a.word < b.word;
+}
+
+void lidx_complete_list_update(lidx_complete_list * list, const std::string & word, uint64_t frequency,
+    size_t max_size)
+{
+  int found = 0;
+  for(size_t i = 0 ; i < list->entries.size() ; i ++) {
+    if (list->entries[i].word == word) {
+      list->entries.erase(list->entries.begin() + i);
+      found = 1;
+      break;
+    }
+  }
+  if (frequency == 0) {
+    return;
+  }
+  if (!found && (frequency <= list->floor)) {
+    // The word is still below the floor.
+    return;
+  }
+
+  lidx_complete_entry entry;
+  entry.word = word;
+  entry.frequency = frequency;
+  size_t position = 0;
+  while ((position < list->entries.size()) && entry_less(list->entries[position], entry)) {
+    position ++;
+  }
+  list->entries.insert(list->entries.begin() + position, entry);
+  if (list->entries.size() > max_size) {
+    if (list->entries.back().frequency > list->floor) {
+      list->floor = list->entries.back().frequency;
+    }
+    list->entries.pop_back();
+  }
+}
+
+size_t lidx_complete_list_exact_count(const lidx_complete_list & list)
+{
+  size_t count = 0;
+  while ((count < list.entries.size()) && (list.entries[count].frequency > list.floor)) {
+    count ++;
+  }
+  return count;
+}
+
+void lidx_complete_builder_add(lidx_complete_builder * builder, const std::string & word, uint64_t frequency)
+{
+  std::vector<std::string> prefixes;
+  lidx_complete_short_prefixes(word, &prefixes);
+  for(size_t i = 0 ; i < prefixes.size() ; i ++) {
+    std::map<std::string, lidx_complete_list>::iterator lists_iterator = builder->lists.find(prefixes[i]);
+    if (lists_iterator == builder->lists.end()) {
+      lidx_complete_list list;
+      lidx_complete_list_init(&list);
+      lists_iterator = builder->lists.insert(std::pair<std::string, lidx_complete_list>(prefixes[i], list)).first;
+    }
+    lidx_complete_list_update(&lists_iterator->second, word, frequency, LIDX_COMPLETE_LIST_SIZE);
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef LIDX_COMPLETE_H
+
+#define LIDX_COMPLETE_H
+
+#include <inttypes.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Completion of words.
+//
+// \0d[word] -> number of documents that contain the word, including the
+// removed documents until they're vacuumed
+// \0c[prefix] -> [floor], [frequency, word length, word]
+//
+// Prefixes of up to 2 characters, including the empty prefix, have a list of
+// the most frequent words that start with them. The words that are not in
+// the list have a frequency lower or equal to `floor`, so the entries of the
+// list that are above `floor` are the top of the prefix.
+
+// Number of words in the list of a short prefix.
+#define LIDX_COMPLETE_LIST_SIZE 16
+// Maximum number of characters of a prefix that has a list.
+#define LIDX_COMPLETE_SHORT_PREFIX_LENGTH 2
+
+struct lidx_complete_entry {
+  std::string word;
+  uint64_t frequency;
+};
+
+struct lidx_complete_list {
+  uint64_t floor;
+  // Sorted by decreasing frequency, then by word.
+  std::vector<lidx_complete_entry> entries;
+};
+
+void lidx_complete_frequency_key(std::string & key, const std::string & word);
+void lidx_complete_list_key(std::string & key, const std::string & prefix);
+
+// Stores the prefixes of `word` that have a list in `* p_prefixes`.
+void lidx_complete_short_prefixes(const std::string & word, std::vector<std::string> * p_prefixes);
+// Returns 1 if the prefix has a list.
+int lidx_complete_is_short_prefix(const std::string & prefix);
+
+void lidx_complete_list_init(lidx_complete_list * list);
+void lidx_complete_list_encode(std::string & buffer, const lidx_complete_list & list);
+void lidx_complete_list_decode(std::string & buffer, lidx_complete_list * p_list);
+
+// Sets the frequency of `word` in the list. A zero frequency removes the word.
+// The list keeps at most `max_size` words.
+void lidx_complete_list_update(lidx_complete_list * list, const std::string & word, uint64_t frequency,
+    size_t max_size);
+
+// Returns the number of entries of the list that are known to be the most
+// frequent words of the prefix.
+size_t lidx_complete_list_exact_count(const lidx_complete_list & list);
+
+// Builds the lists of all the short prefixes from the frequencies of all the words.
+struct lidx_complete_builder {
+  std::map<std::string, lidx_complete_list> lists;
+};
+
+void lidx_complete_builder_add(lidx_complete_builder * builder, const std::string & word, uint64_t frequency);
+
+#endif
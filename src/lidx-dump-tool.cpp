@@ -0,0 +1,93 @@
+// lidx-dump: copies an index through a binary stream.
+//
+// usage: lidx-dump index.lidx dump.bin
+//        lidx-dump -r dump.bin index.lidx
+// Writes a dump of the index, see `lidx_dump()`.
+// -r: creates the index from the dump, see `lidx_restore()`. The index must
+// not exist or be empty.
+// Use "-" to write the dump to the standard output or to read it from the
+// standard input.
+
+#include "lidx.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: lidx-dump index.lidx dump.bin\n");
+  fprintf(stderr, "       lidx-dump -r dump.bin index.lidx\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char ** argv)
+{
+  int restore = 0;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "r")) != -1) {
+    switch (ch) {
+      case 'r':
+        restore = 1;
+        break;
+      default:
+        usage();
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc != 2) {
+    usage();
+  }
+
+  const char * dump_filename = restore ? argv[0] : argv[1];
+  const char * index_filename = restore ? argv[1] : argv[0];
+  int fd = restore ? 0 : 1;
+  if (strcmp(dump_filename, "-") != 0) {
+    if (restore) {
+      fd = open(dump_filename, O_RDONLY);
+    }
+    else {
+      fd = open(dump_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0) {
+      perror(dump_filename);
+      return EXIT_FAILURE;
+    }
+  }
+
+  lidx * index = lidx_new();
+  if (lidx_open(index, index_filename) < 0) {
+    fprintf(stderr, "lidx-dump: could not open %s\n", index_filename);
+    lidx_free(index);
+    return EXIT_FAILURE;
+  }
+
+  int r;
+  if (restore) {
+    r = lidx_restore(index, fd);
+  }
+  else {
+    r = lidx_dump(index, fd);
+  }
+  lidx_close(index);
+  lidx_free(index);
+  if (fd > 1) {
+    close(fd);
+  }
+  if (r < 0) {
+    if (restore) {
+      fprintf(stderr, "lidx-dump: could not restore %s, the dump is corrupted, uses another normalization or the index is not empty\n", index_filename);
+      fprintf(stderr, "lidx-dump: %s must be deleted before restoring it again\n", index_filename);
+    }
+    else {
+      fprintf(stderr, "lidx-dump: could not write the dump of %s\n", index_filename);
+    }
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
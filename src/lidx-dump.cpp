@@ -0,0 +1,326 @@
+#include "lidx-dump.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "lidx-encode.h"
+
+#define DUMP_MAGIC "LIDXDMP1"
+#define DUMP_MAGIC_LENGTH 8
+// Size of the payload of a block after which the block is written.
+#define DUMP_BLOCK_SIZE (64 * 1024)
+// Larger blocks are considered as corrupted.
+#define DUMP_MAX_BLOCK_SIZE (1024 * 1024 * 1024)
+// Size of the writes sent at once to the storage by `lidx_dump_read()`.
+#define DUMP_BATCH_SIZE (4 * 1024 * 1024)
+// Size of the reads on the file descriptor.
+#define DUMP_READ_SIZE (1024 * 1024)
+
+// CRC32 (IEEE 802.3).
+
+static void dump_crc32_init_table(uint32_t * table)
+{
+  for(uint32_t i = 0 ; i < 256 ; i ++) {
+    uint32_t value = i;
+    for(int k = 0 ; k < 8 ; k ++) {
+      value = (value & 1) ? (0xedb88320 ^ (value >> 1)) : (value >> 1);
+    }
+    table[i] = value;
+  }
+}
+
+static uint32_t dump_crc32(const std::string & data)
+{
+  static uint32_t table[256];
+  static int table_initialized = (dump_crc32_init_table(table), 1);
+  (void) table_initialized;
+
+  uint32_t crc = 0xffffffff;
+  const unsigned char * bytes = (const unsigned char *) data.data();
+  for(size_t i = 0 ; i < data.size() ; i ++) {
+    crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc ^ 0xffffffff;
+}
+
+static void dump_encode_crc32(std::string & buffer, const std::string & data)
+{
+  uint32_t crc = dump_crc32(data);
+  for(int i = 0 ; i < 4 ; i ++) {
+    buffer.push_back((char) ((crc >> (i * 8)) & 0xff));
+  }
+}
+
+// Writer.
+
+static int dump_write_all(int fd, const std::string & data)
+{
+  size_t position = 0;
+  while (position < data.size()) {
+    ssize_t count = write(fd, data.data() + position, data.size() - position);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    position += count;
+  }
+  return 0;
+}
+
+static int dump_write_block(int fd, const std::string & payload)
+{
+  std::string block;
+  lidx_encode_uint64(block, payload.size());
+  block.append(payload);
+  dump_encode_crc32(block, payload);
+  return dump_write_all(fd, block);
+}
+
+int lidx_dump_write(lidx_storage_iterator * iterator, int fd)
+{
+  if (dump_write_all(fd, std::string(DUMP_MAGIC, DUMP_MAGIC_LENGTH)) < 0) {
+    return -1;
+  }
+
+  uint64_t keys_count = 0;
+  uint64_t keys_size = 0;
+  std::string payload;
+  std::string last_key;
+  for(iterator->seek_to_first() ; iterator->is_valid() ; iterator->next()) {
+    leveldb::Slice key = iterator->key();
+    leveldb::Slice value = iterator->value();
+    size_t shared = 0;
+    size_t max_shared = std::min(last_key.size(), key.size());
+    while ((shared < max_shared) && (last_key[shared] == key[shared])) {
+      shared ++;
+    }
+    lidx_encode_uint64(payload, shared);
+    lidx_encode_uint64(payload, key.size() - shared);
+    payload.append(key.data() + shared, key.size() - shared);
+    lidx_encode_uint64(payload, value.size());
+    payload.append(value.data(), value.size());
+    keys_count ++;
+    keys_size += key.size() + value.size();
+
+    if (payload.size() >= DUMP_BLOCK_SIZE) {
+      if (dump_write_block(fd, payload) < 0) {
+        return -1;
+      }
+      payload.clear();
+      last_key.clear();
+    }
+    else {
+      last_key.assign(key.data(), key.size());
+    }
+  }
+  if (iterator->status() < 0) {
+    return -1;
+  }
+  if ((payload.size() > 0) && (dump_write_block(fd, payload) < 0)) {
+    return -1;
+  }
+
+  std::string trailer;
+  std::string totals;
+  lidx_encode_uint64(totals, keys_count);
+  lidx_encode_uint64(totals, keys_size);
+  lidx_encode_uint64(trailer, 0);
+  trailer.append(totals);
+  dump_encode_crc32(trailer, totals);
+  return dump_write_all(fd, trailer);
+}
+
+// Reader.
+
+struct dump_reader {
+  int fd;
+  std::string buffer;
+  size_t position;
+};
+
+// Makes sure that `size` bytes are available in the buffer.
+// Returns -1 at the end of the stream or on error.
+static int dump_reader_fill(dump_reader * reader, size_t size)
+{
+  if (reader->buffer.size() - reader->position >= size) {
+    return 0;
+  }
+  reader->buffer.erase(0, reader->position);
+  reader->position = 0;
+  std::string chunk;
+  while (reader->buffer.size() < size) {
+    chunk.resize(std::max((size_t) DUMP_READ_SIZE, size - reader->buffer.size()));
+    ssize_t count = read(reader->fd, &chunk[0], chunk.size());
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (count == 0) {
+      return -1;
+    }
+    reader->buffer.append(chunk, 0, count);
+  }
+  return 0;
+}
+
+static int dump_reader_read_varint(dump_reader * reader, uint64_t * p_value)
+{
+  uint64_t value = 0;
+  for(int shift = 0 ; shift < 64 ; shift += 7) {
+    if (dump_reader_fill(reader, 1) < 0) {
+      return -1;
+    }
+    unsigned char c = reader->buffer[reader->position];
+    reader->position ++;
+    value |= ((uint64_t) c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      * p_value = value;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int dump_reader_read(dump_reader * reader, size_t size, std::string * p_data)
+{
+  if (dump_reader_fill(reader, size) < 0) {
+    return -1;
+  }
+  p_data->assign(reader->buffer, reader->position, size);
+  reader->position += size;
+  return 0;
+}
+
+// Checks the CRC32 that follows `data` in the stream.
+static int dump_reader_check_crc32(dump_reader * reader, const std::string & data)
+{
+  std::string crc;
+  if (dump_reader_read(reader, 4, &crc) < 0) {
+    return -1;
+  }
+  std::string expected_crc;
+  dump_encode_crc32(expected_crc, data);
+  if (crc != expected_crc) {
+    return -1;
+  }
+  return 0;
+}
+
+// Decodes a varint of the payload. Returns -1 if it goes past the end of the payload.
+static int dump_decode(std::string & payload, size_t * p_position, uint64_t * p_value)
+{
+  if (* p_position >= payload.size()) {
+    return -1;
+  }
+  * p_position = lidx_decode_uint64(payload, * p_position, p_value);
+  if (* p_position > payload.size()) {
+    return -1;
+  }
+  return 0;
+}
+
+// Adds the keys of the block to the batch. Keys have to be greater than `* p_last_key`.
+static int dump_decode_block(std::string & payload, std::string * p_last_key, int first_key,
+    lidx_storage_batch * batch, uint64_t * p_keys_count, uint64_t * p_keys_size)
+{
+  std::string key;
+  std::string value;
+  size_t position = 0;
+  while (position < payload.size()) {
+    uint64_t shared;
+    uint64_t unshared;
+    uint64_t value_length;
+    if ((dump_decode(payload, &position, &shared) < 0) ||
+      (dump_decode(payload, &position, &unshared) < 0) ||
+      (shared > key.size()) ||
+      (unshared > payload.size() - position)) {
+      return -1;
+    }
+    key.resize(shared);
+    key.append(payload, position, unshared);
+    position += unshared;
+    if ((dump_decode(payload, &position, &value_length) < 0) ||
+      (value_length > payload.size() - position)) {
+      return -1;
+    }
+    value.assign(payload, position, value_length);
+    position += value_length;
+
+    if (!first_key && (key <= * p_last_key)) {
+      return -1;
+    }
+    first_key = 0;
+    * p_last_key = key;
+    (* p_keys_count) ++;
+    (* p_keys_size) += key.size() + value.size();
+    lidx_storage_batch_put(batch, key, value);
+  }
+  return 0;
+}
+
+int lidx_dump_read(int fd, lidx_storage * storage)
+{
+  dump_reader reader;
+  reader.fd = fd;
+  reader.position = 0;
+
+  std::string magic;
+  if ((dump_reader_read(&reader, DUMP_MAGIC_LENGTH, &magic) < 0) ||
+    (memcmp(magic.data(), DUMP_MAGIC, DUMP_MAGIC_LENGTH) != 0)) {
+    return -1;
+  }
+
+  uint64_t keys_count = 0;
+  uint64_t keys_size = 0;
+  std::string last_key;
+  std::string payload;
+  lidx_storage_batch batch;
+  lidx_storage_batch_init(&batch);
+  while (1) {
+    uint64_t length;
+    if ((dump_reader_read_varint(&reader, &length) < 0) ||
+      (length > DUMP_MAX_BLOCK_SIZE)) {
+      return -1;
+    }
+    if (length == 0) {
+      break;
+    }
+    if ((dump_reader_read(&reader, length, &payload) < 0) ||
+      (dump_reader_check_crc32(&reader, payload) < 0)) {
+      return -1;
+    }
+    if (dump_decode_block(payload, &last_key, (keys_count == 0), &batch, &keys_count, &keys_size) < 0) {
+      return -1;
+    }
+    if (batch.size >= DUMP_BATCH_SIZE) {
+      if (storage->write(&batch) < 0) {
+        return -1;
+      }
+      lidx_storage_batch_init(&batch);
+    }
+  }
+
+  // Trailer.
+  uint64_t expected_keys_count;
+  uint64_t expected_keys_size;
+  if ((dump_reader_read_varint(&reader, &expected_keys_count) < 0) ||
+    (dump_reader_read_varint(&reader, &expected_keys_size) < 0)) {
+    return -1;
+  }
+  std::string totals;
+  lidx_encode_uint64(totals, expected_keys_count);
+  lidx_encode_uint64(totals, expected_keys_size);
+  if ((dump_reader_check_crc32(&reader, totals) < 0) ||
+    (expected_keys_count != keys_count) ||
+    (expected_keys_size != keys_size)) {
+    return -1;
+  }
+  return storage->write(&batch);
+}
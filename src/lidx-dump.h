@@ -0,0 +1,28 @@
+#ifndef LIDX_DUMP_H
+
+#define LIDX_DUMP_H
+
+#include "lidx-storage.h"
+
+// Dump of all the keys of an index, see `lidx_dump()`.
+//
+// The stream starts with "LIDXDMP1" followed by blocks:
+// [payload length], [payload], [CRC32 of the payload]
+// The payload is a sequence of keys in increasing order:
+// [shared length], [unshared length], [unshared bytes of the key], [value length], [value]
+// `shared length` is the length of the prefix shared with the previous key
+// of the block, it's zero for the first key of a block.
+// A block with an empty payload ends the stream. It's followed by:
+// [number of keys], [size of the keys and the values], [CRC32 of these two numbers]
+// Lengths and numbers are varints. CRC32 are 4 bytes, little endian.
+
+// Writes the keys of the iterator to the file descriptor, from the first one.
+// Returns -1 on error.
+int lidx_dump_write(lidx_storage_iterator * iterator, int fd);
+
+// Reads a dump from the file descriptor and writes its keys to the storage
+// in large batches, in order. Returns -1 if the dump is truncated, corrupted
+// or on error. The keys read before the error are written to the storage.
+int lidx_dump_read(int fd, lidx_storage * storage);
+
+#endif
@@ -5,6 +5,7 @@
 #include <pthread.h>
 
 #include "lidx-utils.h"
+#include "lidx-stats.h"
 
 #if __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
@@ -171,7 +172,8 @@ UChar * lidx_from_utf8(const char * word)
   UChar * uword = (UChar *) malloc(sizeof(* uword) * (len + 1));
   uword[len] = 0;
   UErrorCode status = U_ZERO_ERROR;
-  u_strFromUTF8(uword, len + 1, NULL, word, len, &status);
+  // Invalid sequences are replaced with U+FFFD.
+  u_strFromUTF8WithSub(uword, len + 1, NULL, word, len, 0xfffd, NULL, &status);
   return uword;
 #endif
 }
@@ -198,7 +200,18 @@ char * lidx_to_utf8(const UChar * word)
 
 // transliterate to ASCII
 
+static char * transliterate(const UChar * text, int length);
+
 char * lidx_transliterate(const UChar * text, int length)
+{
+  uint64_t start = lidx_stats_now_ns();
+  char * result = transliterate(text, length);
+  lidx_stats_add(lidx_stats_counter_icu_calls, 1);
+  lidx_stats_add(lidx_stats_counter_icu_time_ns, lidx_stats_now_ns() - start);
+  return result;
+}
+
+static char * transliterate(const UChar * text, int length)
 {
 #if __APPLE__
   if (length == -1) {
@@ -240,3 +253,56 @@ char * lidx_transliterate(const UChar * text, int length)
   return NULL;
 #endif
 }
+
+// lowercase without transliteration
+
+static char * lowercase(const UChar * text, int length);
+
+char * lidx_lowercase(const UChar * text, int length)
+{
+  uint64_t start = lidx_stats_now_ns();
+  char * result = lowercase(text, length);
+  lidx_stats_add(lidx_stats_counter_icu_calls, 1);
+  lidx_stats_add(lidx_stats_counter_icu_time_ns, lidx_stats_now_ns() - start);
+  return result;
+}
+
+static char * lowercase(const UChar * text, int length)
+{
+#if __APPLE__
+  if (length == -1) {
+    length = lidx_u_get_length(text);
+  }
+
+  CFMutableStringRef cfStr = CFStringCreateMutable(NULL, 0);
+  CFStringAppendCharacters(cfStr, (const UniChar *) text, length);
+  CFStringLowercase(cfStr, NULL);
+  CFIndex bufferLength = CFStringGetMaximumSizeForEncoding(CFStringGetLength(cfStr), kCFStringEncodingUTF8) + 1;
+  char * buffer = (char *) malloc(bufferLength);
+  buffer[0] = 0;
+  CFStringGetCString(cfStr, buffer, bufferLength, kCFStringEncodingUTF8);
+  CFRelease(cfStr);
+  return buffer;
+#else
+  if (length == -1) {
+    length = u_strlen(text);
+  }
+  
+  UErrorCode status = U_ZERO_ERROR;
+  int32_t lower_length = u_strToLower(NULL, 0, text, length, "", &status);
+  if (status != U_BUFFER_OVERFLOW_ERROR && U_FAILURE(status)) {
+    return NULL;
+  }
+  status = U_ZERO_ERROR;
+  UChar * lower = (UChar *) malloc(sizeof(* lower) * (lower_length + 1));
+  u_strToLower(lower, lower_length + 1, text, length, "", &status);
+  if (U_FAILURE(status)) {
+    free(lower);
+    return NULL;
+  }
+  lower[lower_length] = 0;
+  char * result = lidx_to_utf8(lower);
+  free(lower);
+  return result;
+#endif
+}
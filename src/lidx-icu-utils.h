@@ -36,6 +36,7 @@ unsigned int lidx_u_get_length(const UChar * word);
 UChar * lidx_from_utf8(const char * word);
 char * lidx_to_utf8(const UChar * word);
 char * lidx_transliterate(const UChar * text, int length);
+char * lidx_lowercase(const UChar * text, int length);
 
 #ifdef __cplusplus
 }
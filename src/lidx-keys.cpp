@@ -0,0 +1,42 @@
+#include "lidx-keys.h"
+
+#define WORD_ESCAPE '\1'
+
+void lidx_metadata_key(std::string & key, char kind)
+{
+  key.assign(1, '\0');
+  key.push_back(kind);
+}
+
+int lidx_is_word_key(const leveldb::Slice & key)
+{
+  if (key.size() == 0) {
+    return 0;
+  }
+  switch (key[0]) {
+    case '\0':
+    case ',':
+    case '.':
+    case '/':
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+void lidx_word_key(std::string & key, const std::string & word)
+{
+  key.clear();
+  if ((word.size() > 0) && ((word[0] == ',') || (word[0] == '.') || (word[0] == '/') || (word[0] == WORD_ESCAPE))) {
+    key.push_back(WORD_ESCAPE);
+  }
+  key.append(word);
+}
+
+leveldb::Slice lidx_key_word(const leveldb::Slice & key)
+{
+  if ((key.size() > 0) && (key[0] == WORD_ESCAPE)) {
+    return leveldb::Slice(key.data() + 1, key.size() - 1);
+  }
+  return key;
+}
@@ -0,0 +1,45 @@
+#ifndef LIDX_KEYS_H
+
+#define LIDX_KEYS_H
+
+#include <string>
+
+#include <leveldb/slice.h>
+
+// Keys of an index.
+//
+// . -> next word id
+// ,[docid] -> [words ids]
+// /[word id] -> word
+// [word] -> [word id], [docs ids]
+// \0[kind][...] -> metadata
+//
+// Words are C strings: a key that starts with \0 is never a word. A word
+// that starts with one of the characters used by the other keys (, . /) or
+// with \1 is stored as \1[word].
+//
+// Metadata:
+// \0c[prefix], \0d[word] -> completion, see lidx-complete.h
+// \0n -> normalization of the words, see `lidx_normalization`
+// \0t[docid / 1024] -> bitmap of removed docs ids
+// \0v -> state of an interrupted vacuum, see `lidx_vacuum()`
+
+#define LIDX_METADATA_COMPLETION 'c'
+#define LIDX_METADATA_FREQUENCY 'd'
+#define LIDX_METADATA_NORMALIZATION 'n'
+#define LIDX_METADATA_TOMBSTONES 't'
+#define LIDX_METADATA_VACUUM 'v'
+
+// Stores the prefix of the metadata keys of the given kind in `key`.
+void lidx_metadata_key(std::string & key, char kind);
+
+// Returns 1 if `key` is the key of a word.
+int lidx_is_word_key(const leveldb::Slice & key);
+
+// Stores the key of `word` in `key`.
+void lidx_word_key(std::string & key, const std::string & word);
+
+// Returns the word stored in the key of a word.
+leveldb::Slice lidx_key_word(const leveldb::Slice & key);
+
+#endif
@@ -0,0 +1,200 @@
+#include "lidx-query-cache.h"
+
+#include <stdlib.h>
+
+#include <list>
+#include <map>
+
+#include "lidx-encode.h"
+#include "lidx-stats.h"
+
+// Approximate memory used by an entry besides the key and the result.
+#define QUERY_CACHE_ENTRY_OVERHEAD 128
+
+struct query_cache_entry {
+  // kind of search followed by the token.
+  std::string key;
+  // sorted docs ids, encoded as deltas.
+  std::string docsids;
+  uint64_t generation;
+};
+
+typedef std::list<query_cache_entry> query_cache_lru;
+
+struct lidx_query_cache {
+  size_t cache_max_size;
+  size_t cache_size;
+  uint64_t cache_generation;
+  // Most recently used first.
+  query_cache_lru * cache_lru;
+  // Entries are grouped by kind of search in the map.
+  std::map<std::string, query_cache_lru::iterator> * cache_entries;
+  // Number of entries of each kind of search.
+  size_t cache_kind_count[lidx_search_kind_suffix + 1];
+};
+
+static std::string query_cache_key(const std::string & token, lidx_search_kind kind);
+static size_t query_cache_entry_size(const query_cache_entry & entry);
+static void query_cache_remove(lidx_query_cache * cache, std::map<std::string, query_cache_lru::iterator>::iterator entries_iterator);
+static void query_cache_remove_key(lidx_query_cache * cache, const std::string & token, lidx_search_kind kind);
+
+lidx_query_cache * lidx_query_cache_new(size_t max_size)
+{
+  lidx_query_cache * result = (lidx_query_cache *) calloc(1, sizeof(* result));
+  result->cache_max_size = max_size;
+  result->cache_lru = new query_cache_lru();
+  result->cache_entries = new std::map<std::string, query_cache_lru::iterator>();
+  return result;
+}
+
+void lidx_query_cache_free(lidx_query_cache * cache)
+{
+  delete cache->cache_lru;
+  delete cache->cache_entries;
+  free(cache);
+}
+
+int lidx_query_cache_get(lidx_query_cache * cache, const std::string & token, lidx_search_kind kind,
+    std::vector<uint64_t> * p_docsids)
+{
+  std::map<std::string, query_cache_lru::iterator>::iterator entries_iterator = cache->cache_entries->find(query_cache_key(token, kind));
+  if (entries_iterator == cache->cache_entries->end()) {
+    lidx_stats_add(lidx_stats_counter_query_cache_misses, 1);
+    return -1;
+  }
+  if (entries_iterator->second->generation != cache->cache_generation) {
+    query_cache_remove(cache, entries_iterator);
+    lidx_stats_add(lidx_stats_counter_query_cache_misses, 1);
+    return -1;
+  }
+
+  cache->cache_lru->splice(cache->cache_lru->begin(), * cache->cache_lru, entries_iterator->second);
+  std::string & docsids = entries_iterator->second->docsids;
+  size_t position = 0;
+  uint64_t docid = 0;
+  p_docsids->clear();
+  while (position < docsids.size()) {
+    uint64_t delta;
+    position = lidx_decode_uint64(docsids, position, &delta);
+    docid += delta;
+    p_docsids->push_back(docid);
+  }
+  lidx_stats_add(lidx_stats_counter_query_cache_hits, 1);
+  return 0;
+}
+
+void lidx_query_cache_put(lidx_query_cache * cache, const std::string & token, lidx_search_kind kind,
+    const std::vector<uint64_t> & docsids)
+{
+  std::string key = query_cache_key(token, kind);
+  std::map<std::string, query_cache_lru::iterator>::iterator entries_iterator = cache->cache_entries->find(key);
+  if (entries_iterator != cache->cache_entries->end()) {
+    query_cache_remove(cache, entries_iterator);
+  }
+
+  query_cache_entry entry;
+  entry.key = key;
+  entry.generation = cache->cache_generation;
+  uint64_t previous_docid = 0;
+  for(size_t i = 0 ; i < docsids.size() ; i ++) {
+    lidx_encode_uint64(entry.docsids, docsids[i] - previous_docid);
+    previous_docid = docsids[i];
+  }
+  size_t size = query_cache_entry_size(entry);
+  if (size > cache->cache_max_size) {
+    return;
+  }
+
+  cache->cache_lru->push_front(entry);
+  (* cache->cache_entries)[key] = cache->cache_lru->begin();
+  cache->cache_kind_count[kind] ++;
+  cache->cache_size += size;
+  while (cache->cache_size > cache->cache_max_size) {
+    query_cache_remove(cache, cache->cache_entries->find(cache->cache_lru->back().key));
+  }
+}
+
+void lidx_query_cache_invalidate_word(lidx_query_cache * cache, const std::string & word)
+{
+  if (cache->cache_entries->size() == 0) {
+    return;
+  }
+
+  // The prefix searches that match the word are the prefixes of the word.
+  for(size_t length = 0 ; length <= word.size() ; length ++) {
+    query_cache_remove_key(cache, word.substr(0, length), lidx_search_kind_prefix);
+  }
+
+  // The suffix searches that match the word are the suffixes of the word.
+  for(size_t position = 0 ; position <= word.size() ; position ++) {
+    query_cache_remove_key(cache, word.substr(position), lidx_search_kind_suffix);
+  }
+
+  // The substring searches that match the word are the substrings of the
+  // word. They're looked up one by one unless there are fewer cached
+  // substring searches than substrings, so that the cost of a word doesn't
+  // depend on the size of the cache.
+  size_t substr_count = word.size() * (word.size() + 1) / 2 + 1;
+  if (substr_count <= cache->cache_kind_count[lidx_search_kind_substr]) {
+    query_cache_remove_key(cache, std::string(), lidx_search_kind_substr);
+    for(size_t position = 0 ; position < word.size() ; position ++) {
+      for(size_t length = 1 ; position + length <= word.size() ; length ++) {
+        query_cache_remove_key(cache, word.substr(position, length), lidx_search_kind_substr);
+      }
+    }
+    return;
+  }
+
+  std::string substr_start = query_cache_key(std::string(), lidx_search_kind_substr);
+  std::string substr_end = query_cache_key(std::string(), lidx_search_kind_suffix);
+  std::map<std::string, query_cache_lru::iterator>::iterator entries_iterator = cache->cache_entries->lower_bound(substr_start);
+  while ((entries_iterator != cache->cache_entries->end()) && (entries_iterator->first < substr_end)) {
+    const std::string & key = entries_iterator->first;
+    std::map<std::string, query_cache_lru::iterator>::iterator next_iterator = entries_iterator;
+    ++ next_iterator;
+    if (word.find(key.c_str() + 1, 0, key.size() - 1) != std::string::npos) {
+      query_cache_remove(cache, entries_iterator);
+      lidx_stats_add(lidx_stats_counter_query_cache_invalidations, 1);
+    }
+    entries_iterator = next_iterator;
+  }
+}
+
+void lidx_query_cache_invalidate_all(lidx_query_cache * cache)
+{
+  // Stale entries are removed when they are looked up or evicted.
+  cache->cache_generation ++;
+}
+
+static std::string query_cache_key(const std::string & token, lidx_search_kind kind)
+{
+  std::string key;
+  key.push_back('0' + (char) kind);
+  key.append(token);
+  return key;
+}
+
+static size_t query_cache_entry_size(const query_cache_entry & entry)
+{
+  // The key is stored in the entry and in the map.
+  return entry.key.size() * 2 + entry.docsids.size() + QUERY_CACHE_ENTRY_OVERHEAD;
+}
+
+static void query_cache_remove(lidx_query_cache * cache, std::map<std::string, query_cache_lru::iterator>::iterator entries_iterator)
+{
+  cache->cache_kind_count[entries_iterator->first[0] - '0'] --;
+  cache->cache_size -= query_cache_entry_size(* entries_iterator->second);
+  cache->cache_lru->erase(entries_iterator->second);
+  cache->cache_entries->erase(entries_iterator);
+}
+
+// Removes the entry of the search, if it's cached.
+static void query_cache_remove_key(lidx_query_cache * cache, const std::string & token, lidx_search_kind kind)
+{
+  std::map<std::string, query_cache_lru::iterator>::iterator entries_iterator = cache->cache_entries->find(query_cache_key(token, kind));
+  if (entries_iterator == cache->cache_entries->end()) {
+    return;
+  }
+  query_cache_remove(cache, entries_iterator);
+  lidx_stats_add(lidx_stats_counter_query_cache_invalidations, 1);
+}
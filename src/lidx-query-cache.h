@@ -0,0 +1,34 @@
+#ifndef LIDX_QUERY_CACHE_H
+
+#define LIDX_QUERY_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include "lidx.h"
+
+// LRU cache of the results of the searches, keyed by the normalized token
+// and the kind of search.
+// An entry is dropped when a word it matches is changed. When the tombstones
+// change, all the entries are invalidated by bumping the generation.
+
+typedef struct lidx_query_cache lidx_query_cache;
+
+// `max_size`: approximate memory used by the cached results, in bytes.
+lidx_query_cache * lidx_query_cache_new(size_t max_size);
+void lidx_query_cache_free(lidx_query_cache * cache);
+
+// Returns 0 and stores the sorted documents ids in `* p_docsids` if the
+// result is cached, -1 otherwise.
+int lidx_query_cache_get(lidx_query_cache * cache, const std::string & token, lidx_search_kind kind,
+    std::vector<uint64_t> * p_docsids);
+// `docsids` needs to be sorted.
+void lidx_query_cache_put(lidx_query_cache * cache, const std::string & token, lidx_search_kind kind,
+    const std::vector<uint64_t> & docsids);
+
+// Drops the entries that match `word`.
+void lidx_query_cache_invalidate_word(lidx_query_cache * cache, const std::string & word);
+// Invalidates all the entries.
+void lidx_query_cache_invalidate_all(lidx_query_cache * cache);
+
+#endif
@@ -0,0 +1,232 @@
+// lidx-replay: replays a trace recorded with `lidx_trace_start()`.
+//
+// usage: lidx-replay [-r] [-o output.json] trace index.lidx
+//        lidx-replay -m [-r] [-o output.json] trace
+//
+// The calls are replayed on the given index as it is: to replay a trace
+// recorded on an existing index, replay it on a copy of that index.
+// -m replays on an empty in-memory index instead.
+// -r replays at the original speed: each call starts at the same time since
+// the start of the trace as when it was recorded. By default, the calls are
+// replayed as fast as possible.
+// For each kind of call, the latency distribution of the recorded calls and
+// of the replayed calls are written as JSON to the standard output or to the
+// file given with -o, with the number of searches that returned a different
+// number of results than when they were recorded.
+// A document indexed from UTF-16 text is indexed again with `lidx_u_set2()`.
+
+#include "lidx.h"
+#include "lidx-icu-utils.h"
+#include "lidx-trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+struct replay_latencies {
+  // In nanoseconds.
+  std::vector<uint64_t> recorded;
+  std::vector<uint64_t> replayed;
+};
+
+static uint64_t replay_now_ns(void)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t replay_percentile(std::vector<uint64_t> & values, double percentile)
+{
+  if (values.size() == 0) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t position = (size_t) (percentile * (values.size() - 1) + 0.5);
+  return values[position];
+}
+
+static void replay_print_latencies(FILE * output, std::vector<uint64_t> & values)
+{
+  fprintf(output, "{\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}",
+    replay_percentile(values, 0.50) / 1e3,
+    replay_percentile(values, 0.90) / 1e3,
+    replay_percentile(values, 0.99) / 1e3,
+    replay_percentile(values, 1.0) / 1e3);
+}
+
+// Writes `value` as a JSON string.
+static void replay_print_string(FILE * output, const char * value)
+{
+  fputc('"', output);
+  for(const char * p = value ; * p != '\0' ; p ++) {
+    unsigned char c = (unsigned char) * p;
+    if ((c == '"') || (c == '\\')) {
+      fprintf(output, "\\%c", c);
+    }
+    else if (c < 0x20) {
+      fprintf(output, "\\u%04x", c);
+    }
+    else {
+      fputc(c, output);
+    }
+  }
+  fputc('"', output);
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: lidx-replay [-r] [-o output.json] trace index.lidx\n");
+  fprintf(stderr, "       lidx-replay -m [-r] [-o output.json] trace\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char ** argv)
+{
+  int in_memory = 0;
+  int original_speed = 0;
+  const char * output_path = NULL;
+
+  int ch;
+  while ((ch = getopt(argc, argv, "mro:")) != -1) {
+    switch (ch) {
+      case 'm':
+        in_memory = 1;
+        break;
+      case 'r':
+        original_speed = 1;
+        break;
+      case 'o':
+        output_path = optarg;
+        break;
+      default:
+        usage();
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc != (in_memory ? 1 : 2)) {
+    usage();
+  }
+  const char * trace_path = argv[0];
+
+  lidx_trace_reader * reader = lidx_trace_reader_open(trace_path);
+  if (reader == NULL) {
+    fprintf(stderr, "lidx-replay: could not read trace %s\n", trace_path);
+    return EXIT_FAILURE;
+  }
+
+  lidx * index = lidx_new();
+  if (in_memory) {
+    lidx_open_memory(index);
+  }
+  else if (lidx_open(index, argv[1]) < 0) {
+    fprintf(stderr, "lidx-replay: could not open %s\n", argv[1]);
+    lidx_free(index);
+    lidx_trace_reader_close(reader);
+    return EXIT_FAILURE;
+  }
+
+  const char * ops_names[] = { "set", "remove", "search", "flush" };
+  replay_latencies latencies[4];
+  unsigned int search_mismatches = 0;
+  int corrupted = 0;
+  uint64_t replay_start = replay_now_ns();
+  lidx_trace_record record;
+  while (1) {
+    int r = lidx_trace_reader_next(reader, &record);
+    if (r == 0) {
+      break;
+    }
+    if (r < 0) {
+      corrupted = 1;
+      break;
+    }
+    if (original_speed) {
+      uint64_t elapsed = replay_now_ns() - replay_start;
+      if (record.start_ns > elapsed) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(record.start_ns - elapsed));
+      }
+    }
+
+    // The conversion to UTF-16 is not part of the recorded call.
+    UChar * utext = NULL;
+    if ((record.op == lidx_trace_op_set) && record.utf16) {
+      utext = lidx_from_utf8(record.text.c_str());
+    }
+
+    uint64_t start = replay_now_ns();
+    switch (record.op) {
+      case lidx_trace_op_set:
+        if (utext != NULL) {
+          lidx_u_set2(index, record.doc, utext, record.tokenize_enabled);
+        }
+        else {
+          lidx_set2(index, record.doc, record.text.c_str(), record.tokenize_enabled);
+        }
+        break;
+      case lidx_trace_op_remove:
+        lidx_remove(index, record.doc);
+        break;
+      case lidx_trace_op_search:
+      {
+        uint64_t * docsids = NULL;
+        size_t count = 0;
+        lidx_search(index, record.text.c_str(), record.kind, &docsids, &count);
+        free(docsids);
+        if (count != record.count) {
+          search_mismatches ++;
+        }
+        break;
+      }
+      case lidx_trace_op_flush:
+        lidx_flush(index);
+        break;
+    }
+    latencies[record.op - 1].replayed.push_back(replay_now_ns() - start);
+    free(utext);
+    latencies[record.op - 1].recorded.push_back(record.duration_ns);
+  }
+  double replay_duration = (replay_now_ns() - replay_start) / 1e9;
+  lidx_trace_reader_close(reader);
+  lidx_close(index);
+  lidx_free(index);
+  if (corrupted) {
+    fprintf(stderr, "lidx-replay: %s is truncated or corrupted, replayed the calls before the error\n", trace_path);
+  }
+
+  FILE * output = stdout;
+  if (output_path != NULL) {
+    output = fopen(output_path, "w");
+    if (output == NULL) {
+      perror(output_path);
+      return EXIT_FAILURE;
+    }
+  }
+  fprintf(output, "{\n");
+  fprintf(output, "  \"config\": {\"trace\": ");
+  replay_print_string(output, trace_path);
+  fprintf(output, ", \"original_speed\": %d, \"in_memory\": %d},\n", original_speed, in_memory);
+  fprintf(output, "  \"seconds\": %.6f,\n", replay_duration);
+  for(int op = 0 ; op < 4 ; op ++) {
+    fprintf(output, "  \"%s\": {\"count\": %llu, \"recorded\": ", ops_names[op],
+      (unsigned long long) latencies[op].replayed.size());
+    replay_print_latencies(output, latencies[op].recorded);
+    fprintf(output, ", \"replayed\": ");
+    replay_print_latencies(output, latencies[op].replayed);
+    if (op == lidx_trace_op_search - 1) {
+      fprintf(output, ", \"mismatches\": %u", search_mismatches);
+    }
+    fprintf(output, "},\n");
+  }
+  fprintf(output, "  \"corrupted\": %d\n", corrupted);
+  fprintf(output, "}\n");
+  if (output != stdout) {
+    fclose(output);
+  }
+
+  return corrupted ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+#include "lidx-stats.h"
+
+#include "lidx.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <mutex>
+#include <set>
+
+// Each thread updates its own shard. Only the owner thread writes to a shard,
+// so the counters are updated with a relaxed load and store instead of an
+// atomic read-modify-write. A concurrent reset might be lost.
+// When a thread exits, its shard is merged into `s_retired`.
+
+struct stats_histogram {
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> buckets[LIDX_STATS_HISTOGRAM_BUCKETS];
+};
+
+struct stats_shard {
+  std::atomic<uint64_t> counters[lidx_stats_counter_count];
+  stats_histogram histograms[lidx_stats_histogram_count];
+};
+
+static std::atomic<int64_t> s_gauges[lidx_stats_gauge_count];
+static std::mutex s_lock;
+static std::set<stats_shard *> * s_shards = NULL;
+static stats_shard * s_retired = NULL;
+
+static void shard_clear(stats_shard * shard);
+
+struct stats_thread_shard {
+  stats_shard * shard;
+
+  stats_thread_shard() {
+    shard = new stats_shard();
+    shard_clear(shard);
+    std::lock_guard<std::mutex> lock(s_lock);
+    if (s_shards == NULL) {
+      s_shards = new std::set<stats_shard *>();
+      s_retired = new stats_shard();
+      shard_clear(s_retired);
+    }
+    s_shards->insert(shard);
+  }
+
+  ~stats_thread_shard() {
+    std::lock_guard<std::mutex> lock(s_lock);
+    for(int i = 0 ; i < lidx_stats_counter_count ; i ++) {
+      s_retired->counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+    }
+    for(int i = 0 ; i < lidx_stats_histogram_count ; i ++) {
+      s_retired->histograms[i].count += shard->histograms[i].count.load(std::memory_order_relaxed);
+      s_retired->histograms[i].sum += shard->histograms[i].sum.load(std::memory_order_relaxed);
+      for(int k = 0 ; k < LIDX_STATS_HISTOGRAM_BUCKETS ; k ++) {
+        s_retired->histograms[i].buckets[k] += shard->histograms[i].buckets[k].load(std::memory_order_relaxed);
+      }
+    }
+    s_shards->erase(shard);
+    delete shard;
+  }
+};
+
+static inline stats_shard * current_shard(void)
+{
+  static thread_local stats_thread_shard thread_shard;
+  return thread_shard.shard;
+}
+
+static inline void relaxed_add(std::atomic<uint64_t> & value, uint64_t delta)
+{
+  value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+void lidx_stats_add(lidx_stats_counter counter, uint64_t value)
+{
+  relaxed_add(current_shard()->counters[counter], value);
+}
+
+void lidx_stats_record(lidx_stats_histogram_kind histogram, uint64_t value)
+{
+  stats_histogram & h = current_shard()->histograms[histogram];
+  int bucket = 0;
+  while ((value >> bucket) != 0 && bucket < LIDX_STATS_HISTOGRAM_BUCKETS - 1) {
+    bucket ++;
+  }
+  relaxed_add(h.count, 1);
+  relaxed_add(h.sum, value);
+  relaxed_add(h.buckets[bucket], 1);
+}
+
+void lidx_stats_gauge_add(lidx_stats_gauge gauge, int64_t delta)
+{
+  s_gauges[gauge].fetch_add(delta, std::memory_order_relaxed);
+}
+
+uint64_t lidx_stats_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void shard_clear(stats_shard * shard)
+{
+  for(int i = 0 ; i < lidx_stats_counter_count ; i ++) {
+    shard->counters[i].store(0, std::memory_order_relaxed);
+  }
+  for(int i = 0 ; i < lidx_stats_histogram_count ; i ++) {
+    shard->histograms[i].count.store(0, std::memory_order_relaxed);
+    shard->histograms[i].sum.store(0, std::memory_order_relaxed);
+    for(int k = 0 ; k < LIDX_STATS_HISTOGRAM_BUCKETS ; k ++) {
+      shard->histograms[i].buckets[k].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+static void add_shard(stats_shard * shard, uint64_t * counters, lidx_stats_histogram * histograms)
+{
+  for(int i = 0 ; i < lidx_stats_counter_count ; i ++) {
+    counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+  }
+  for(int i = 0 ; i < lidx_stats_histogram_count ; i ++) {
+    histograms[i].count += shard->histograms[i].count.load(std::memory_order_relaxed);
+    histograms[i].sum += shard->histograms[i].sum.load(std::memory_order_relaxed);
+    for(int k = 0 ; k < LIDX_STATS_HISTOGRAM_BUCKETS ; k ++) {
+      histograms[i].buckets[k] += shard->histograms[i].buckets[k].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void lidx_get_stats(lidx_stats * stats)
+{
+  uint64_t counters[lidx_stats_counter_count];
+  lidx_stats_histogram histograms[lidx_stats_histogram_count];
+  memset(counters, 0, sizeof(counters));
+  memset(histograms, 0, sizeof(histograms));
+  
+  // Makes sure that the shards are initialized.
+  current_shard();
+  {
+    std::lock_guard<std::mutex> lock(s_lock);
+    add_shard(s_retired, counters, histograms);
+    for(std::set<stats_shard *>::iterator shard_iterator = s_shards->begin() ; shard_iterator != s_shards->end() ; ++ shard_iterator) {
+      add_shard(* shard_iterator, counters, histograms);
+    }
+  }
+  
+  memset(stats, 0, sizeof(* stats));
+  stats->get_buffer_hits = counters[lidx_stats_counter_get_buffer_hits];
+  stats->get_buffer_misses = counters[lidx_stats_counter_get_buffer_misses];
+  stats->flush_count = counters[lidx_stats_counter_flush_count];
+  stats->flush_keys = counters[lidx_stats_counter_flush_keys];
+  stats->flush_bytes = counters[lidx_stats_counter_flush_bytes];
+  stats->flush_latency_us = histograms[lidx_stats_histogram_flush_latency_us];
+  stats->buffer_keys = s_gauges[lidx_stats_gauge_buffer_keys].load(std::memory_order_relaxed);
+  stats->buffer_bytes = s_gauges[lidx_stats_gauge_buffer_bytes].load(std::memory_order_relaxed);
+  stats->set_count = counters[lidx_stats_counter_set_count];
+  stats->tokens_count = counters[lidx_stats_counter_tokens_count];
+  stats->tokens_per_document = histograms[lidx_stats_histogram_tokens_per_document];
+  stats->set_latency_us = histograms[lidx_stats_histogram_set_latency_us];
+  stats->remove_count = counters[lidx_stats_counter_remove_count];
+  stats->search_count = counters[lidx_stats_counter_search_count];
+  stats->search_keys_scanned = counters[lidx_stats_counter_search_keys_scanned];
+  stats->search_keys_matched = counters[lidx_stats_counter_search_keys_matched];
+  stats->search_truncated = counters[lidx_stats_counter_search_truncated];
+  stats->search_keys_scanned_per_search = histograms[lidx_stats_histogram_search_keys_scanned_per_search];
+  stats->search_latency_us = histograms[lidx_stats_histogram_search_latency_us];
+  stats->icu_calls = counters[lidx_stats_counter_icu_calls];
+  stats->icu_time_ns = counters[lidx_stats_counter_icu_time_ns];
+  stats->query_cache_hits = counters[lidx_stats_counter_query_cache_hits];
+  stats->query_cache_misses = counters[lidx_stats_counter_query_cache_misses];
+  stats->query_cache_invalidations = counters[lidx_stats_counter_query_cache_invalidations];
+}
+
+void lidx_reset_stats(void)
+{
+  current_shard();
+  std::lock_guard<std::mutex> lock(s_lock);
+  shard_clear(s_retired);
+  for(std::set<stats_shard *>::iterator shard_iterator = s_shards->begin() ; shard_iterator != s_shards->end() ; ++ shard_iterator) {
+    shard_clear(* shard_iterator);
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef LIDX_STATS_H
+
+#define LIDX_STATS_H
+
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum lidx_stats_counter {
+  lidx_stats_counter_get_buffer_hits,
+  lidx_stats_counter_get_buffer_misses,
+  lidx_stats_counter_flush_count,
+  lidx_stats_counter_flush_keys,
+  lidx_stats_counter_flush_bytes,
+  lidx_stats_counter_set_count,
+  lidx_stats_counter_tokens_count,
+  lidx_stats_counter_remove_count,
+  lidx_stats_counter_search_count,
+  lidx_stats_counter_search_keys_scanned,
+  lidx_stats_counter_search_keys_matched,
+  lidx_stats_counter_search_truncated,
+  lidx_stats_counter_icu_calls,
+  lidx_stats_counter_icu_time_ns,
+  lidx_stats_counter_query_cache_hits,
+  lidx_stats_counter_query_cache_misses,
+  lidx_stats_counter_query_cache_invalidations,
+  lidx_stats_counter_count,
+} lidx_stats_counter;
+
+typedef enum lidx_stats_gauge {
+  lidx_stats_gauge_buffer_keys,
+  lidx_stats_gauge_buffer_bytes,
+  lidx_stats_gauge_count,
+} lidx_stats_gauge;
+
+typedef enum lidx_stats_histogram_kind {
+  lidx_stats_histogram_flush_latency_us,
+  lidx_stats_histogram_tokens_per_document,
+  lidx_stats_histogram_set_latency_us,
+  lidx_stats_histogram_search_keys_scanned_per_search,
+  lidx_stats_histogram_search_latency_us,
+  lidx_stats_histogram_count,
+} lidx_stats_histogram_kind;
+
+// Counters are stored per thread and updated with relaxed atomic operations.
+void lidx_stats_add(lidx_stats_counter counter, uint64_t value);
+void lidx_stats_record(lidx_stats_histogram_kind histogram, uint64_t value);
+// Gauges are current values shared by all the threads. They are not reset.
+void lidx_stats_gauge_add(lidx_stats_gauge gauge, int64_t delta);
+
+// Monotonic clock in nanoseconds.
+uint64_t lidx_stats_now_ns(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,160 @@
+#include "lidx-storage.h"
+
+#include <leveldb/db.h>
+#include <leveldb/status.h>
+#include <leveldb/write_batch.h>
+
+struct leveldb_snapshot : public lidx_storage_snapshot {
+  const leveldb::Snapshot * snapshot;
+};
+
+struct leveldb_iterator : public lidx_storage_iterator {
+  leveldb::Iterator * iterator;
+
+  virtual ~leveldb_iterator()
+  {
+    delete iterator;
+  }
+
+  virtual void seek_to_first()
+  {
+    iterator->SeekToFirst();
+  }
+
+  virtual void seek(const leveldb::Slice & key)
+  {
+    iterator->Seek(key);
+  }
+
+  virtual int is_valid()
+  {
+    return iterator->Valid();
+  }
+
+  virtual void next()
+  {
+    iterator->Next();
+  }
+
+  virtual leveldb::Slice key()
+  {
+    return iterator->key();
+  }
+
+  virtual leveldb::Slice value()
+  {
+    return iterator->value();
+  }
+
+  virtual int status()
+  {
+    return iterator->status().ok() ? 0 : -1;
+  }
+};
+
+struct leveldb_storage : public lidx_storage {
+  leveldb::DB * db;
+
+  virtual ~leveldb_storage()
+  {
+    delete db;
+  }
+
+  virtual int get(const std::string & key, std::string * p_value)
+  {
+    leveldb::ReadOptions read_options;
+    leveldb::Status status = db->Get(read_options, key, p_value);
+    if (status.IsNotFound()) {
+      return -1;
+    }
+    if (!status.ok()) {
+      return -2;
+    }
+    return 0;
+  }
+
+  virtual int write(lidx_storage_batch * batch)
+  {
+    leveldb::WriteBatch db_batch;
+    for(size_t i = 0 ; i < batch->writes.size() ; i ++) {
+      if (batch->writes[i].deleted) {
+        db_batch.Delete(batch->writes[i].key);
+      }
+      else {
+        db_batch.Put(batch->writes[i].key, batch->writes[i].value);
+      }
+    }
+    leveldb::WriteOptions write_options;
+    leveldb::Status status = db->Write(write_options, &db_batch);
+    if (!status.ok()) {
+      return -1;
+    }
+    return 0;
+  }
+
+  virtual const lidx_storage_snapshot * get_snapshot()
+  {
+    leveldb_snapshot * snapshot = new leveldb_snapshot();
+    snapshot->snapshot = db->GetSnapshot();
+    return snapshot;
+  }
+
+  virtual void release_snapshot(const lidx_storage_snapshot * snapshot)
+  {
+    db->ReleaseSnapshot(((const leveldb_snapshot *) snapshot)->snapshot);
+    delete snapshot;
+  }
+
+  virtual lidx_storage_iterator * new_iterator(const lidx_storage_snapshot * snapshot)
+  {
+    leveldb::ReadOptions options;
+    if (snapshot != NULL) {
+      options.snapshot = ((const leveldb_snapshot *) snapshot)->snapshot;
+    }
+    leveldb_iterator * iterator = new leveldb_iterator();
+    iterator->iterator = db->NewIterator(options);
+    return iterator;
+  }
+
+  virtual void get_approximate_sizes(const std::vector<std::pair<std::string, std::string> > & ranges,
+      std::vector<uint64_t> * p_sizes)
+  {
+    p_sizes->resize(ranges.size());
+    if (ranges.size() == 0) {
+      return;
+    }
+    // Keys are UTF-8 words or start with an ASCII character: they're all
+    // lower than a run of 0xff bytes.
+    std::string last_limit(16, '\xff');
+    std::vector<leveldb::Range> db_ranges;
+    for(size_t i = 0 ; i < ranges.size() ; i ++) {
+      db_ranges.push_back(leveldb::Range(ranges[i].first, (ranges[i].second.size() > 0) ? ranges[i].second : last_limit));
+    }
+    db->GetApproximateSizes(&db_ranges[0], (int) db_ranges.size(), &(* p_sizes)[0]);
+  }
+};
+
+static lidx_storage * leveldb_storage_open(const char * filename, int error_if_exists)
+{
+  leveldb::Options options;
+  leveldb::DB * db;
+  options.create_if_missing = true;
+  options.error_if_exists = error_if_exists;
+  leveldb::Status status = leveldb::DB::Open(options, filename, &db);
+  if (!status.ok()) {
+    return NULL;
+  }
+  leveldb_storage * storage = new leveldb_storage();
+  storage->db = db;
+  return storage;
+}
+
+lidx_storage * lidx_storage_leveldb_open(const char * filename)
+{
+  return leveldb_storage_open(filename, 0);
+}
+
+lidx_storage * lidx_storage_leveldb_create(const char * filename)
+{
+  return leveldb_storage_open(filename, 1);
+}
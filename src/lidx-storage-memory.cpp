@@ -0,0 +1,370 @@
+#include "lidx-storage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+// Copy-on-write B+tree.
+// Nodes are shared between the current tree, the snapshots and the
+// iterators. A write modifies a node in place when nothing else refers to
+// it and copies it otherwise, so the trees seen by the snapshots and the
+// iterators never change. Taking a snapshot only copies the root.
+// Each node knows the size of its subtree, which gives the size of a range
+// in logarithmic time.
+// Nodes are not merged when keys are deleted, only removed when they're empty.
+
+// Maximum number of entries of a leaf or of children of an inner node.
+#define MEMORY_NODE_MAX_SIZE 64
+
+struct memory_node;
+typedef std::shared_ptr<memory_node> memory_node_ref;
+
+struct memory_node {
+  int leaf;
+  // Size of the keys and the values of the subtree.
+  uint64_t bytes;
+  // Leaves: sorted keys. Inner nodes: `keys[i]` is lower or equal to the
+  // keys of `children[i]` and greater than the keys of `children[i - 1]`.
+  std::vector<std::string> keys;
+  // Leaves only.
+  std::vector<std::string> values;
+  // Inner nodes only.
+  std::vector<memory_node_ref> children;
+};
+
+static memory_node_ref memory_node_new(int leaf)
+{
+  memory_node_ref node = std::make_shared<memory_node>();
+  node->leaf = leaf;
+  node->bytes = 0;
+  return node;
+}
+
+// Index of the child of an inner node that holds `key`.
+static inline size_t memory_child_index(memory_node * node, const std::string & key)
+{
+  return std::upper_bound(node->keys.begin() + 1, node->keys.end(), key) - node->keys.begin() - 1;
+}
+
+static const std::string * memory_find(memory_node * node, const std::string & key)
+{
+  while (!node->leaf) {
+    node = node->children[memory_child_index(node, key)].get();
+  }
+  std::vector<std::string>::iterator keys_iterator = std::lower_bound(node->keys.begin(), node->keys.end(), key);
+  if ((keys_iterator == node->keys.end()) || (* keys_iterator != key)) {
+    return NULL;
+  }
+  return &node->values[keys_iterator - node->keys.begin()];
+}
+
+// Size of the keys and the values of the subtree that are lower than `key`.
+static uint64_t memory_bytes_before(memory_node * node, const std::string & key)
+{
+  uint64_t result = 0;
+  while (!node->leaf) {
+    size_t child_index = memory_child_index(node, key);
+    for(size_t i = 0 ; i < child_index ; i ++) {
+      result += node->children[i]->bytes;
+    }
+    node = node->children[child_index].get();
+  }
+  size_t count = std::lower_bound(node->keys.begin(), node->keys.end(), key) - node->keys.begin();
+  for(size_t i = 0 ; i < count ; i ++) {
+    result += node->keys[i].size() + node->values[i].size();
+  }
+  return result;
+}
+
+// Makes sure that `node` can be modified.
+// It's called with the lock of the storage held. Other threads only get new
+// references to a root while holding the lock, so a count of 1 can't grow
+// anymore. The count is read with a relaxed load: the acquire fence pairs
+// with the release done by another thread when it dropped its reference, so
+// its reads of the node happen before the node is modified here.
+static inline void memory_make_unique(memory_node_ref & node)
+{
+  if (node.use_count() > 1) {
+    node = std::make_shared<memory_node>(* node);
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+// Moves the upper half of the node to a new node.
+static memory_node_ref memory_split(memory_node * node)
+{
+  memory_node_ref right = memory_node_new(node->leaf);
+  size_t half = node->keys.size() / 2;
+  right->keys.assign(std::make_move_iterator(node->keys.begin() + half), std::make_move_iterator(node->keys.end()));
+  node->keys.resize(half);
+  if (node->leaf) {
+    right->values.assign(std::make_move_iterator(node->values.begin() + half), std::make_move_iterator(node->values.end()));
+    node->values.resize(half);
+    for(size_t i = 0 ; i < right->keys.size() ; i ++) {
+      right->bytes += right->keys[i].size() + right->values[i].size();
+    }
+  }
+  else {
+    right->children.assign(node->children.begin() + half, node->children.end());
+    node->children.resize(half);
+    for(size_t i = 0 ; i < right->children.size() ; i ++) {
+      right->bytes += right->children[i]->bytes;
+    }
+  }
+  node->bytes -= right->bytes;
+  return right;
+}
+
+// Sets the value of the key in the subtree. The key and the value are moved
+// into the tree. When the node is split, the new node that holds the upper
+// half is stored in `* p_split`.
+static void memory_put(memory_node_ref & node, std::string & key, std::string & value,
+    memory_node_ref * p_split)
+{
+  memory_make_unique(node);
+  memory_node * current = node.get();
+  if (current->leaf) {
+    size_t position = std::lower_bound(current->keys.begin(), current->keys.end(), key) - current->keys.begin();
+    if ((position < current->keys.size()) && (current->keys[position] == key)) {
+      current->bytes = current->bytes - current->values[position].size() + value.size();
+      current->values[position].swap(value);
+    }
+    else {
+      current->bytes += key.size() + value.size();
+      current->keys.insert(current->keys.begin() + position, std::string());
+      current->keys[position].swap(key);
+      current->values.insert(current->values.begin() + position, std::string());
+      current->values[position].swap(value);
+    }
+  }
+  else {
+    size_t child_index = memory_child_index(current, key);
+    uint64_t child_bytes = current->children[child_index]->bytes;
+    memory_node_ref split;
+    memory_put(current->children[child_index], key, value, &split);
+    current->bytes = current->bytes - child_bytes + current->children[child_index]->bytes;
+    if (split.get() != NULL) {
+      current->bytes += split->bytes;
+      current->keys.insert(current->keys.begin() + child_index + 1, split->keys[0]);
+      current->children.insert(current->children.begin() + child_index + 1, split);
+    }
+  }
+  if (current->keys.size() > MEMORY_NODE_MAX_SIZE) {
+    * p_split = memory_split(current);
+  }
+}
+
+// Removes the key from the subtree. The key has to be in the subtree.
+static void memory_delete(memory_node_ref & node, const std::string & key)
+{
+  memory_make_unique(node);
+  memory_node * current = node.get();
+  if (current->leaf) {
+    size_t position = std::lower_bound(current->keys.begin(), current->keys.end(), key) - current->keys.begin();
+    current->bytes -= current->keys[position].size() + current->values[position].size();
+    current->keys.erase(current->keys.begin() + position);
+    current->values.erase(current->values.begin() + position);
+    return;
+  }
+
+  size_t child_index = memory_child_index(current, key);
+  uint64_t child_bytes = current->children[child_index]->bytes;
+  memory_delete(current->children[child_index], key);
+  current->bytes = current->bytes - child_bytes + current->children[child_index]->bytes;
+  if (current->children[child_index]->keys.size() == 0) {
+    current->keys.erase(current->keys.begin() + child_index);
+    current->children.erase(current->children.begin() + child_index);
+  }
+}
+
+struct memory_snapshot : public lidx_storage_snapshot {
+  memory_node_ref root;
+};
+
+struct memory_iterator : public lidx_storage_iterator {
+  // Keeps the tree alive while it's iterated.
+  memory_node_ref root;
+  // Inner nodes from the root to the current leaf and the index of the child.
+  std::vector<std::pair<memory_node *, size_t> > path;
+  // NULL when the iterator is not valid.
+  memory_node * leaf;
+  size_t position;
+
+  virtual void seek_to_first()
+  {
+    seek(leveldb::Slice());
+  }
+
+  virtual void seek(const leveldb::Slice & key)
+  {
+    std::string key_str = key.ToString();
+    path.clear();
+    memory_node * node = root.get();
+    while (!node->leaf) {
+      size_t child_index = memory_child_index(node, key_str);
+      path.push_back(std::pair<memory_node *, size_t>(node, child_index));
+      node = node->children[child_index].get();
+    }
+    leaf = node;
+    position = std::lower_bound(node->keys.begin(), node->keys.end(), key_str) - node->keys.begin();
+    skip_to_next_leaf();
+  }
+
+  virtual int is_valid()
+  {
+    return leaf != NULL;
+  }
+
+  virtual void next()
+  {
+    position ++;
+    skip_to_next_leaf();
+  }
+
+  virtual leveldb::Slice key()
+  {
+    return leveldb::Slice(leaf->keys[position]);
+  }
+
+  virtual leveldb::Slice value()
+  {
+    return leveldb::Slice(leaf->values[position]);
+  }
+
+  virtual int status()
+  {
+    return 0;
+  }
+
+  // Moves to the first entry of the next leaf when the position is past the
+  // end of the current one.
+  void skip_to_next_leaf()
+  {
+    while ((leaf != NULL) && (position >= leaf->keys.size())) {
+      while ((path.size() > 0) && (path.back().second + 1 >= path.back().first->children.size())) {
+        path.pop_back();
+      }
+      if (path.size() == 0) {
+        leaf = NULL;
+        return;
+      }
+      path.back().second ++;
+      memory_node * node = path.back().first->children[path.back().second].get();
+      while (!node->leaf) {
+        path.push_back(std::pair<memory_node *, size_t>(node, 0));
+        node = node->children[0].get();
+      }
+      leaf = node;
+      position = 0;
+    }
+  }
+};
+
+struct memory_storage : public lidx_storage {
+  // Protects `root`. The nodes reachable from a copy of the root never change.
+  std::mutex lock;
+  memory_node_ref root;
+
+  memory_node_ref current_root()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return root;
+  }
+
+  virtual int get(const std::string & key, std::string * p_value)
+  {
+    memory_node_ref tree = current_root();
+    const std::string * value = memory_find(tree.get(), key);
+    if (value == NULL) {
+      return -1;
+    }
+    * p_value = * value;
+    return 0;
+  }
+
+  virtual int write(lidx_storage_batch * batch)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for(size_t i = 0 ; i < batch->writes.size() ; i ++) {
+      lidx_storage_write & write = batch->writes[i];
+      if (write.deleted) {
+        if (memory_find(root.get(), write.key) == NULL) {
+          continue;
+        }
+        memory_delete(root, write.key);
+        while (!root->leaf && (root->children.size() <= 1)) {
+          if (root->children.size() == 0) {
+            root = memory_node_new(1);
+          }
+          else {
+            root = root->children[0];
+          }
+        }
+      }
+      else {
+        memory_node_ref split;
+        memory_put(root, write.key, write.value, &split);
+        if (split.get() != NULL) {
+          memory_node_ref new_root = memory_node_new(0);
+          new_root->bytes = root->bytes + split->bytes;
+          new_root->keys.push_back(root->keys[0]);
+          new_root->keys.push_back(split->keys[0]);
+          new_root->children.push_back(root);
+          new_root->children.push_back(split);
+          root = new_root;
+        }
+      }
+    }
+    return 0;
+  }
+
+  virtual const lidx_storage_snapshot * get_snapshot()
+  {
+    memory_snapshot * snapshot = new memory_snapshot();
+    snapshot->root = current_root();
+    return snapshot;
+  }
+
+  virtual void release_snapshot(const lidx_storage_snapshot * snapshot)
+  {
+    delete snapshot;
+  }
+
+  virtual lidx_storage_iterator * new_iterator(const lidx_storage_snapshot * snapshot)
+  {
+    memory_iterator * iterator = new memory_iterator();
+    if (snapshot != NULL) {
+      iterator->root = ((const memory_snapshot *) snapshot)->root;
+    }
+    else {
+      iterator->root = current_root();
+    }
+    iterator->leaf = NULL;
+    iterator->position = 0;
+    return iterator;
+  }
+
+  virtual void get_approximate_sizes(const std::vector<std::pair<std::string, std::string> > & ranges,
+      std::vector<uint64_t> * p_sizes)
+  {
+    memory_node_ref tree = current_root();
+    p_sizes->resize(ranges.size());
+    for(size_t i = 0 ; i < ranges.size() ; i ++) {
+      uint64_t start_bytes = memory_bytes_before(tree.get(), ranges[i].first);
+      uint64_t limit_bytes = tree->bytes;
+      if (ranges[i].second.size() > 0) {
+        limit_bytes = memory_bytes_before(tree.get(), ranges[i].second);
+      }
+      (* p_sizes)[i] = (limit_bytes > start_bytes) ? limit_bytes - start_bytes : 0;
+    }
+  }
+};
+
+lidx_storage * lidx_storage_memory_new(void)
+{
+  memory_storage * storage = new memory_storage();
+  storage->root = memory_node_new(1);
+  return storage;
+}
@@ -0,0 +1,26 @@
+#include "lidx-storage.h"
+
+void lidx_storage_batch_init(lidx_storage_batch * batch)
+{
+  batch->writes.clear();
+  batch->size = 0;
+}
+
+void lidx_storage_batch_put(lidx_storage_batch * batch, const std::string & key, const std::string & value)
+{
+  lidx_storage_write write;
+  write.key = key;
+  write.value = value;
+  write.deleted = 0;
+  batch->writes.push_back(write);
+  batch->size += key.size() + value.size();
+}
+
+void lidx_storage_batch_delete(lidx_storage_batch * batch, const std::string & key)
+{
+  lidx_storage_write write;
+  write.key = key;
+  write.deleted = 1;
+  batch->writes.push_back(write);
+  batch->size += key.size();
+}
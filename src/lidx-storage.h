@@ -0,0 +1,83 @@
+#ifndef LIDX_STORAGE_H
+
+#define LIDX_STORAGE_H
+
+#include <inttypes.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <leveldb/slice.h>
+
+// Sorted key-value store that holds the keys of an index.
+// Keys and values returned by iterators are valid until the iterator moves.
+
+// Writes applied in order by `lidx_storage::write()`.
+struct lidx_storage_write {
+  std::string key;
+  std::string value;
+  // 1 when the key is deleted.
+  int deleted;
+};
+
+struct lidx_storage_batch {
+  std::vector<lidx_storage_write> writes;
+  // Size of the keys and the values of the writes.
+  size_t size;
+};
+
+void lidx_storage_batch_init(lidx_storage_batch * batch);
+void lidx_storage_batch_put(lidx_storage_batch * batch, const std::string & key, const std::string & value);
+void lidx_storage_batch_delete(lidx_storage_batch * batch, const std::string & key);
+
+// Consistent view of the store. Writes done after the snapshot is taken
+// are not visible through it.
+struct lidx_storage_snapshot {
+  virtual ~lidx_storage_snapshot() {}
+};
+
+struct lidx_storage_iterator {
+  virtual ~lidx_storage_iterator() {}
+  virtual void seek_to_first() = 0;
+  // Moves to the first key greater or equal to `key`.
+  virtual void seek(const leveldb::Slice & key) = 0;
+  virtual int is_valid() = 0;
+  virtual void next() = 0;
+  virtual leveldb::Slice key() = 0;
+  virtual leveldb::Slice value() = 0;
+  // Returns -1 if an error happened while reading.
+  virtual int status() = 0;
+};
+
+struct lidx_storage {
+  virtual ~lidx_storage() {}
+  // Returns 0 if the key was found, -1 if not, -2 on error.
+  virtual int get(const std::string & key, std::string * p_value) = 0;
+  // Applies all the writes of the batch atomically. Returns -1 on error.
+  // The keys and the values of the batch can be moved out of it.
+  virtual int write(lidx_storage_batch * batch) = 0;
+  // The snapshot has to be released using `release_snapshot()`.
+  virtual const lidx_storage_snapshot * get_snapshot() = 0;
+  virtual void release_snapshot(const lidx_storage_snapshot * snapshot) = 0;
+  // Iterates on a snapshot, or on the current content when `snapshot` is NULL.
+  // The iterator has to be deleted before the snapshot is released.
+  virtual lidx_storage_iterator * new_iterator(const lidx_storage_snapshot * snapshot) = 0;
+  // Stores in `* p_sizes` the approximate size in bytes of each range
+  // [start, limit). An empty limit is the end of the keys.
+  virtual void get_approximate_sizes(const std::vector<std::pair<std::string, std::string> > & ranges,
+      std::vector<uint64_t> * p_sizes) = 0;
+};
+
+// Opens a LevelDB database, which is created if it doesn't exist.
+// Returns NULL on error.
+lidx_storage * lidx_storage_leveldb_open(const char * filename);
+
+// Creates a LevelDB database. Returns NULL if it already exists or on error.
+lidx_storage * lidx_storage_leveldb_create(const char * filename);
+
+// Creates an empty store in memory. Iterators and snapshots can be used from
+// other threads while the store is written.
+lidx_storage * lidx_storage_memory_new(void);
+
+#endif
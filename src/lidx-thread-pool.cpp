@@ -0,0 +1,116 @@
+#include "lidx-thread-pool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// The pool is created on first use and lives until the process exits.
+// Its threads are never joined.
+
+struct thread_pool {
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<std::function<void ()> > queue;
+  unsigned int size;
+};
+
+// Tasks submitted by one call of `lidx_thread_pool_run()`.
+struct thread_pool_batch {
+  std::mutex lock;
+  std::condition_variable cond;
+  size_t remaining;
+};
+
+static thread_pool * s_pool = NULL;
+static std::once_flag s_pool_once;
+
+static void pool_init(void);
+static void pool_worker(void);
+
+unsigned int lidx_thread_pool_size(void)
+{
+  std::call_once(s_pool_once, pool_init);
+  return s_pool->size;
+}
+
+void lidx_thread_pool_run(std::vector<std::function<void ()> > & tasks)
+{
+  std::call_once(s_pool_once, pool_init);
+  if (tasks.size() == 0) {
+    return;
+  }
+  if ((tasks.size() == 1) || (s_pool->size == 1)) {
+    for(size_t i = 0 ; i < tasks.size() ; i ++) {
+      tasks[i]();
+    }
+    return;
+  }
+
+  std::shared_ptr<thread_pool_batch> batch(new thread_pool_batch());
+  batch->remaining = tasks.size();
+  {
+    std::lock_guard<std::mutex> lock(s_pool->lock);
+    for(size_t i = 0 ; i < tasks.size() ; i ++) {
+      std::function<void ()> task = tasks[i];
+      s_pool->queue.push_back([batch, task]() {
+        task();
+        std::lock_guard<std::mutex> lock(batch->lock);
+        batch->remaining --;
+        if (batch->remaining == 0) {
+          batch->cond.notify_all();
+        }
+      });
+    }
+  }
+  s_pool->cond.notify_all();
+
+  // Helps the workers until the queue is empty.
+  while (1) {
+    std::function<void ()> task;
+    {
+      std::lock_guard<std::mutex> lock(s_pool->lock);
+      if (s_pool->queue.size() == 0) {
+        break;
+      }
+      task = s_pool->queue.front();
+      s_pool->queue.pop_front();
+    }
+    task();
+  }
+
+  std::unique_lock<std::mutex> lock(batch->lock);
+  while (batch->remaining > 0) {
+    batch->cond.wait(lock);
+  }
+}
+
+static void pool_init(void)
+{
+  s_pool = new thread_pool();
+  s_pool->size = std::thread::hardware_concurrency();
+  if (s_pool->size == 0) {
+    s_pool->size = 1;
+  }
+  // The calling thread is one of the threads running the tasks.
+  for(unsigned int i = 1 ; i < s_pool->size ; i ++) {
+    std::thread(pool_worker).detach();
+  }
+}
+
+static void pool_worker(void)
+{
+  while (1) {
+    std::function<void ()> task;
+    {
+      std::unique_lock<std::mutex> lock(s_pool->lock);
+      while (s_pool->queue.size() == 0) {
+        s_pool->cond.wait(lock);
+      }
+      task = s_pool->queue.front();
+      s_pool->queue.pop_front();
+    }
+    task();
+  }
+}
@@ -0,0 +1,17 @@
+#ifndef LIDX_THREAD_POOL_H
+
+#define LIDX_THREAD_POOL_H
+
+#include <functional>
+#include <vector>
+
+// Process-wide pool with one thread per core.
+
+// Number of tasks that can run at the same time.
+unsigned int lidx_thread_pool_size(void);
+
+// Runs the tasks on the pool and returns when all of them are done.
+// The calling thread runs tasks too.
+void lidx_thread_pool_run(std::vector<std::function<void ()> > & tasks);
+
+#endif
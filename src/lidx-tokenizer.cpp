@@ -0,0 +1,587 @@
+#include "lidx-tokenizer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include "lidx-utils.h"
+#include "lidx-icu-utils.h"
+#include "lidx-stats.h"
+
+#if __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#endif
+
+// Tokenization is a pipeline: segmenter -> filter -> normalizer.
+// A segmenter returns the segments of the text and their kind, the filter
+// keeps the words and the normalizer turns them into the UTF-8 strings that
+// are stored in the index.
+// Each configuration is a specialization of `tokenize_pipeline`, so that the
+// choice of the segmenter and of the normalizer is made once per document
+// and not for each word.
+
+// Segmenters.
+
+#if __APPLE__
+struct word_segmenter {
+  typedef UChar char_type;
+
+  CFStringRef str;
+  CFStringTokenizerRef tokenizer;
+
+  word_segmenter(const UChar * text, int32_t length) {
+    str = CFStringCreateWithBytes(NULL, (const UInt8 *) text, length * sizeof(* text), kCFStringEncodingUTF16LE, false);
+    tokenizer = CFStringTokenizerCreate(NULL, str, CFRangeMake(0, length), kCFStringTokenizerUnitWord, NULL);
+  }
+
+  ~word_segmenter() {
+    CFRelease(str);
+    CFRelease(tokenizer);
+  }
+
+  // Returns 0 when there are no more segments.
+  int next(int32_t * p_left, int32_t * p_right, int * p_is_word) {
+    CFStringTokenizerTokenType wordKind = CFStringTokenizerAdvanceToNextToken(tokenizer);
+    if (wordKind == kCFStringTokenizerTokenNone) {
+      return 0;
+    }
+    CFRange range = CFStringTokenizerGetCurrentTokenRange(tokenizer);
+    * p_left = (int32_t) range.location;
+    * p_right = (int32_t) (range.location + range.length);
+    * p_is_word = (wordKind != kCFStringTokenizerTokenHasNonLettersMask);
+    return 1;
+  }
+};
+#else
+// Break iterators are expensive to create. Each thread keeps the iterators
+// it has used and re-targets them with `ubrk_setText()`.
+
+struct break_iterator_pool {
+  std::vector<UBreakIterator *> iterators;
+
+  ~break_iterator_pool() {
+    for(size_t i = 0 ; i < iterators.size() ; i ++) {
+      ubrk_close(iterators[i]);
+    }
+  }
+};
+
+static break_iterator_pool & current_break_iterator_pool(void)
+{
+  static thread_local break_iterator_pool pool;
+  return pool;
+}
+
+static UBreakIterator * acquire_break_iterator(const UChar * text, int32_t length)
+{
+  UErrorCode status = U_ZERO_ERROR;
+  UBreakIterator * iterator;
+  break_iterator_pool & pool = current_break_iterator_pool();
+  if (pool.iterators.size() > 0) {
+    iterator = pool.iterators.back();
+    pool.iterators.pop_back();
+    ubrk_setText(iterator, text, length, &status);
+  }
+  else {
+    iterator = ubrk_open(UBRK_WORD, NULL, text, length, &status);
+  }
+  LIDX_ASSERT(status <= U_ZERO_ERROR);
+  return iterator;
+}
+
+static void release_break_iterator(UBreakIterator * iterator)
+{
+  current_break_iterator_pool().iterators.push_back(iterator);
+}
+
+struct word_segmenter {
+  typedef UChar char_type;
+
+  UBreakIterator * iterator;
+  int32_t right;
+  // Time spent in the break iterator, added to the ICU time of the stats.
+  uint64_t icu_time_ns;
+
+  word_segmenter(const UChar * text, int32_t length) {
+    uint64_t start = lidx_stats_now_ns();
+    iterator = acquire_break_iterator(text, length);
+    right = ubrk_first(iterator);
+    icu_time_ns = lidx_stats_now_ns() - start;
+  }
+
+  ~word_segmenter() {
+    release_break_iterator(iterator);
+    lidx_stats_add(lidx_stats_counter_icu_calls, 1);
+    lidx_stats_add(lidx_stats_counter_icu_time_ns, icu_time_ns);
+  }
+
+  // Returns 0 when there are no more segments.
+  int next(int32_t * p_left, int32_t * p_right, int * p_is_word) {
+    int32_t left = right;
+    uint64_t start = lidx_stats_now_ns();
+    right = ubrk_next(iterator);
+    icu_time_ns += lidx_stats_now_ns() - start;
+    if (right == UBRK_DONE) {
+      return 0;
+    }
+    * p_left = left;
+    * p_right = right;
+    // Punctuation and spaces have a rule status of 0.
+    * p_is_word = (ubrk_getRuleStatus(iterator) != 0);
+    return 1;
+  }
+};
+#endif
+
+// The whole text is a single word.
+template <class CharType>
+struct whole_text_segmenter {
+  typedef CharType char_type;
+
+  int32_t length;
+  int done;
+
+  whole_text_segmenter(const CharType *, int32_t length) : length(length), done(0) {
+  }
+
+  int next(int32_t * p_left, int32_t * p_right, int * p_is_word) {
+    if (done) {
+      return 0;
+    }
+    done = 1;
+    * p_left = 0;
+    * p_right = length;
+    * p_is_word = 1;
+    return 1;
+  }
+};
+
+#if !__APPLE__
+// ASCII word boundaries.
+// The word break class of each ASCII character is computed once by asking
+// ICU, so that the ASCII path follows the rules of the ICU library in use.
+
+enum {
+  ASCII_CLASS_OTHER,
+  ASCII_CLASS_SPACE,
+  ASCII_CLASS_LETTER,
+  ASCII_CLASS_NUMERIC,
+  ASCII_CLASS_EXTEND_NUM_LET,
+  ASCII_CLASS_MID_LETTER,
+  ASCII_CLASS_MID_NUM,
+  ASCII_CLASS_MID_NUM_LET,
+};
+
+static unsigned char s_ascii_class[128];
+static pthread_once_t s_ascii_class_once = PTHREAD_ONCE_INIT;
+
+// Returns 1 if `str` is a single segment, and its rule status in `* p_status`.
+static int probe_segment(UBreakIterator * iterator, const char * str, int32_t * p_status)
+{
+  UChar ustr[4];
+  int32_t length = (int32_t) strlen(str);
+  for(int32_t i = 0 ; i < length ; i ++) {
+    ustr[i] = (UChar) str[i];
+  }
+  UErrorCode status = U_ZERO_ERROR;
+  ubrk_setText(iterator, ustr, length, &status);
+  LIDX_ASSERT(status <= U_ZERO_ERROR);
+  ubrk_first(iterator);
+  int32_t right = ubrk_next(iterator);
+  if (p_status != NULL) {
+    * p_status = ubrk_getRuleStatus(iterator);
+  }
+  return right == length;
+}
+
+static void init_ascii_class(void)
+{
+  UBreakIterator * iterator = acquire_break_iterator(NULL, 0);
+
+  for(int c = 0 ; c < 128 ; c ++) {
+    if ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '\v') || (c == '\f')) {
+      s_ascii_class[c] = ASCII_CLASS_SPACE;
+      continue;
+    }
+    if ((c < 0x20) || (c == 0x7f)) {
+      s_ascii_class[c] = ASCII_CLASS_OTHER;
+      continue;
+    }
+
+    char probe[4];
+    int32_t rule_status;
+    probe[0] = (char) c;
+    probe[1] = 0;
+    probe_segment(iterator, probe, &rule_status);
+    if (rule_status >= UBRK_WORD_LETTER) {
+      s_ascii_class[c] = ASCII_CLASS_LETTER;
+      continue;
+    }
+    if (rule_status >= UBRK_WORD_NUMBER) {
+      s_ascii_class[c] = ASCII_CLASS_NUMERIC;
+      continue;
+    }
+
+    probe[0] = 'a';
+    probe[1] = (char) c;
+    probe[2] = 0;
+    if (probe_segment(iterator, probe, NULL)) {
+      s_ascii_class[c] = ASCII_CLASS_EXTEND_NUM_LET;
+      continue;
+    }
+
+    probe[0] = 'a';
+    probe[1] = (char) c;
+    probe[2] = 'b';
+    probe[3] = 0;
+    int mid_letter = probe_segment(iterator, probe, NULL);
+    probe[0] = '1';
+    probe[2] = '2';
+    int mid_num = probe_segment(iterator, probe, NULL);
+    if (mid_letter && mid_num) {
+      s_ascii_class[c] = ASCII_CLASS_MID_NUM_LET;
+    }
+    else if (mid_letter) {
+      s_ascii_class[c] = ASCII_CLASS_MID_LETTER;
+    }
+    else if (mid_num) {
+      s_ascii_class[c] = ASCII_CLASS_MID_NUM;
+    }
+    else {
+      s_ascii_class[c] = ASCII_CLASS_OTHER;
+    }
+  }
+
+  release_break_iterator(iterator);
+}
+
+static inline int is_ascii_word_class(unsigned char ascii_class)
+{
+  return (ascii_class == ASCII_CLASS_LETTER) || (ascii_class == ASCII_CLASS_NUMERIC) ||
+    (ascii_class == ASCII_CLASS_EXTEND_NUM_LET);
+}
+
+static inline int is_ascii_space(char c)
+{
+  return ((unsigned char) c < 0x80) && (s_ascii_class[(unsigned char) c] == ASCII_CLASS_SPACE);
+}
+
+// Splits an ASCII text following the word boundaries rules of Unicode
+// (UAX #29) restricted to ASCII.
+struct ascii_word_segmenter {
+  typedef char char_type;
+
+  const char * text;
+  int32_t length;
+  int32_t position;
+
+  ascii_word_segmenter(const char * text, int32_t length) : text(text), length(length), position(0) {
+  }
+
+  int next(int32_t * p_left, int32_t * p_right, int * p_is_word) {
+    if (position >= length) {
+      return 0;
+    }
+
+    int32_t start = position;
+    unsigned char start_class = s_ascii_class[(unsigned char) text[start]];
+    if (!is_ascii_word_class(start_class)) {
+      position ++;
+      * p_left = start;
+      * p_right = position;
+      * p_is_word = 0;
+      return 1;
+    }
+
+    int32_t end = start + 1;
+    while (end < length) {
+      unsigned char current_class = s_ascii_class[(unsigned char) text[end]];
+      if (is_ascii_word_class(current_class)) {
+        end ++;
+        continue;
+      }
+      if (end + 1 >= length) {
+        break;
+      }
+      unsigned char previous_class = s_ascii_class[(unsigned char) text[end - 1]];
+      unsigned char next_class = s_ascii_class[(unsigned char) text[end + 1]];
+      if ((previous_class == ASCII_CLASS_LETTER) && (next_class == ASCII_CLASS_LETTER) &&
+        ((current_class == ASCII_CLASS_MID_LETTER) || (current_class == ASCII_CLASS_MID_NUM_LET))) {
+        end += 2;
+        continue;
+      }
+      if ((previous_class == ASCII_CLASS_NUMERIC) && (next_class == ASCII_CLASS_NUMERIC) &&
+        ((current_class == ASCII_CLASS_MID_NUM) || (current_class == ASCII_CLASS_MID_NUM_LET))) {
+        end += 2;
+        continue;
+      }
+      break;
+    }
+
+    position = end;
+    * p_left = start;
+    * p_right = end;
+    // A single ExtendNumLet character is not a word.
+    * p_is_word = ((end - start >= 2) || (start_class != ASCII_CLASS_EXTEND_NUM_LET));
+    return 1;
+  }
+};
+#endif
+
+// Filters.
+
+struct word_filter {
+  static inline int accept(int is_word) {
+    return is_word;
+  }
+};
+
+// Normalizers.
+
+struct transliterate_normalizer {
+  typedef UChar char_type;
+
+  inline int operator()(const UChar * text, int32_t length,
+      lidx_tokenize_callback callback, void * context) {
+    char * transliterated = lidx_transliterate(text, length);
+    if (transliterated == NULL) {
+      return 0;
+    }
+    int r = callback(transliterated, context);
+    free(transliterated);
+    return r;
+  }
+};
+
+struct lowercase_normalizer {
+  typedef UChar char_type;
+
+  inline int operator()(const UChar * text, int32_t length,
+      lidx_tokenize_callback callback, void * context) {
+    char * lowercased = lidx_lowercase(text, length);
+    if (lowercased == NULL) {
+      return 0;
+    }
+    int r = callback(lowercased, context);
+    free(lowercased);
+    return r;
+  }
+};
+
+// Transliteration and lowercase of ASCII are the same.
+struct ascii_lowercase_normalizer {
+  typedef char char_type;
+
+  std::string word;
+
+  inline int operator()(const char * text, int32_t length,
+      lidx_tokenize_callback callback, void * context) {
+    word.assign(text, length);
+    for(size_t i = 0 ; i < word.size() ; i ++) {
+      if ((word[i] >= 'A') && (word[i] <= 'Z')) {
+        word[i] += 'a' - 'A';
+      }
+    }
+    return callback(word.c_str(), context);
+  }
+};
+
+template <class Segmenter, class Filter, class Normalizer>
+static int tokenize_pipeline(const typename Segmenter::char_type * text, int32_t length,
+    lidx_tokenize_callback callback, void * context)
+{
+  Segmenter segmenter(text, length);
+  Normalizer normalizer;
+  int32_t left;
+  int32_t right;
+  int is_word;
+  while (segmenter.next(&left, &right, &is_word)) {
+    if (!Filter::accept(is_word)) {
+      continue;
+    }
+    int r = normalizer(&text[left], right - left, callback, context);
+    if (r < 0) {
+      return r;
+    }
+  }
+  return 0;
+}
+
+template <class Normalizer>
+static int tokenize_with_normalizer(const UChar * text, int tokenize_enabled,
+    lidx_tokenize_callback callback, void * context)
+{
+  int32_t length = (int32_t) lidx_u_get_length(text);
+  if (tokenize_enabled) {
+    return tokenize_pipeline<word_segmenter, word_filter, Normalizer>(text, length, callback, context);
+  }
+  else {
+    return tokenize_pipeline<whole_text_segmenter<UChar>, word_filter, Normalizer>(text, length, callback, context);
+  }
+}
+
+int lidx_tokenize(const UChar * text, int tokenize_enabled, lidx_normalization normalization,
+    lidx_tokenize_callback callback, void * context)
+{
+  switch (normalization) {
+    case lidx_normalization_lowercase:
+      return tokenize_with_normalizer<lowercase_normalizer>(text, tokenize_enabled, callback, context);
+    case lidx_normalization_transliterate:
+    default:
+      return tokenize_with_normalizer<transliterate_normalizer>(text, tokenize_enabled, callback, context);
+  }
+}
+
+char * lidx_normalize(const UChar * text, int length, lidx_normalization normalization)
+{
+  switch (normalization) {
+    case lidx_normalization_lowercase:
+      return lidx_lowercase(text, length);
+    case lidx_normalization_transliterate:
+    default:
+      return lidx_transliterate(text, length);
+  }
+}
+
+#if __APPLE__
+int lidx_tokenize_utf8(const char * text, int tokenize_enabled, lidx_normalization normalization,
+    lidx_tokenize_callback callback, void * context)
+{
+  // CFStringTokenizer doesn't follow the same rules as ICU.
+  UChar * utext = lidx_from_utf8(text);
+  int result = lidx_tokenize(utext, tokenize_enabled, normalization, callback, context);
+  free((void *) utext);
+  return result;
+}
+#else
+// Returns the number of ASCII bytes at the beginning of `text`.
+static size_t ascii_prefix_length(const char * text, size_t length)
+{
+  size_t position = 0;
+#if defined(__SSE2__)
+  while (position + 16 <= length) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *) (text + position));
+    int mask = _mm_movemask_epi8(chunk);
+    if (mask != 0) {
+      return position + __builtin_ctz(mask);
+    }
+    position += 16;
+  }
+#else
+  while (position + 8 <= length) {
+    uint64_t chunk;
+    memcpy(&chunk, text + position, sizeof(chunk));
+    if ((chunk & 0x8080808080808080ULL) != 0) {
+      break;
+    }
+    position += 8;
+  }
+#endif
+  while ((position < length) && ((unsigned char) text[position] < 0x80)) {
+    position ++;
+  }
+  return position;
+}
+
+template <class Normalizer>
+static int tokenize_utf8_with_normalizer(const char * text, int tokenize_enabled,
+    lidx_tokenize_callback callback, void * context)
+{
+  pthread_once(&s_ascii_class_once, init_ascii_class);
+
+  size_t length = strlen(text);
+  size_t ascii_length = ascii_prefix_length(text, length);
+  std::vector<UChar> utext;
+  int32_t ulength;
+  UErrorCode status = U_ZERO_ERROR;
+
+  if (!tokenize_enabled) {
+    if (ascii_length == length) {
+      return tokenize_pipeline<whole_text_segmenter<char>, word_filter, ascii_lowercase_normalizer>(text, (int32_t) length,
+        callback, context);
+    }
+    utext.resize(length + 1);
+    u_strFromUTF8WithSub(&utext[0], (int32_t) utext.size(), &ulength, text, (int32_t) length, 0xfffd, NULL, &status);
+    LIDX_ASSERT(status <= U_ZERO_ERROR);
+    return tokenize_pipeline<whole_text_segmenter<UChar>, word_filter, Normalizer>(&utext[0], ulength,
+      callback, context);
+  }
+
+  // Word boundaries are always found around ASCII spaces. The text is split
+  // into parts separated by spaces. A run of parts that contain non-ASCII
+  // characters goes through ICU, the other parts use the ASCII path.
+  int result = 0;
+  size_t position = 0;
+  while (position < length) {
+    size_t non_ascii = position + ascii_prefix_length(text + position, length - position);
+    if (non_ascii == length) {
+      result = tokenize_pipeline<ascii_word_segmenter, word_filter, ascii_lowercase_normalizer>(text + position,
+        (int32_t) (length - position), callback, context);
+      break;
+    }
+
+    size_t start = non_ascii;
+    while ((start > position) && !is_ascii_space(text[start - 1])) {
+      start --;
+    }
+    result = tokenize_pipeline<ascii_word_segmenter, word_filter, ascii_lowercase_normalizer>(text + position,
+      (int32_t) (start - position), callback, context);
+    if (result < 0) {
+      break;
+    }
+
+    size_t end = non_ascii;
+    while (1) {
+      while ((end < length) && !is_ascii_space(text[end])) {
+        end ++;
+      }
+      size_t next_start = end;
+      while ((next_start < length) && is_ascii_space(text[next_start])) {
+        next_start ++;
+      }
+      size_t next_end = next_start;
+      int has_non_ascii = 0;
+      while ((next_end < length) && !is_ascii_space(text[next_end])) {
+        if ((unsigned char) text[next_end] >= 0x80) {
+          has_non_ascii = 1;
+        }
+        next_end ++;
+      }
+      if (!has_non_ascii) {
+        break;
+      }
+      end = next_end;
+    }
+
+    utext.resize(end - start + 1);
+    status = U_ZERO_ERROR;
+    u_strFromUTF8WithSub(&utext[0], (int32_t) utext.size(), &ulength, text + start, (int32_t) (end - start), 0xfffd, NULL, &status);
+    LIDX_ASSERT(status <= U_ZERO_ERROR);
+    result = tokenize_pipeline<word_segmenter, word_filter, Normalizer>(&utext[0], ulength, callback, context);
+    if (result < 0) {
+      break;
+    }
+    position = end;
+  }
+
+  return result;
+}
+
+int lidx_tokenize_utf8(const char * text, int tokenize_enabled, lidx_normalization normalization,
+    lidx_tokenize_callback callback, void * context)
+{
+  switch (normalization) {
+    case lidx_normalization_lowercase:
+      return tokenize_utf8_with_normalizer<lowercase_normalizer>(text, tokenize_enabled, callback, context);
+    case lidx_normalization_transliterate:
+    default:
+      return tokenize_utf8_with_normalizer<transliterate_normalizer>(text, tokenize_enabled, callback, context);
+  }
+}
+#endif
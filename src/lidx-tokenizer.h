@@ -0,0 +1,28 @@
+#ifndef LIDX_TOKENIZER_H
+
+#define LIDX_TOKENIZER_H
+
+#include "lidx.h"
+
+// Called for each normalized word of a document.
+// Returning a negative value stops the tokenization and the value is
+// returned by `lidx_tokenize()`.
+typedef int (* lidx_tokenize_callback)(const char * word, void * context);
+
+// Splits `text` into words and normalizes each of them.
+// When `tokenize_enabled` is zero, the whole text is considered as a single word.
+int lidx_tokenize(const UChar * text, int tokenize_enabled, lidx_normalization normalization,
+    lidx_tokenize_callback callback, void * context);
+
+// Same as `lidx_tokenize()` for a UTF-8 text. The words are identical.
+// ASCII parts of the text are split and lowercased without ICU. Only the
+// non-ASCII parts are converted to UTF-16 and go through the ICU break
+// iterator and the normalizer.
+int lidx_tokenize_utf8(const char * text, int tokenize_enabled, lidx_normalization normalization,
+    lidx_tokenize_callback callback, void * context);
+
+// Normalizes a searched token the same way as the words of the documents.
+// The result has to be freed using `free()`.
+char * lidx_normalize(const UChar * text, int length, lidx_normalization normalization);
+
+#endif
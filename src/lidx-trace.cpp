@@ -0,0 +1,238 @@
+#include "lidx-trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lidx-encode.h"
+#include "lidx-stats.h"
+
+#define TRACE_MAGIC "LIDXTRC1"
+#define TRACE_MAGIC_LENGTH 8
+// Size of the buffered records written at once.
+#define TRACE_WRITE_BUFFER_SIZE (64 * 1024)
+// Larger records are considered as corrupted.
+#define TRACE_MAX_RECORD_SIZE (1024 * 1024 * 1024)
+
+struct lidx_trace_writer {
+  FILE * writer_file;
+  std::string writer_buffer;
+  uint64_t writer_start_ns;
+  uint64_t writer_last_start_ns;
+};
+
+struct lidx_trace_reader {
+  FILE * reader_file;
+  uint64_t reader_last_start_ns;
+};
+
+static void trace_writer_write_buffer(lidx_trace_writer * writer);
+
+lidx_trace_writer * lidx_trace_writer_open(const char * filename)
+{
+  FILE * f = fopen(filename, "wb");
+  if (f == NULL) {
+    return NULL;
+  }
+  lidx_trace_writer * writer = new lidx_trace_writer();
+  writer->writer_file = f;
+  writer->writer_start_ns = lidx_stats_now_ns();
+  writer->writer_last_start_ns = 0;
+  writer->writer_buffer.append(TRACE_MAGIC, TRACE_MAGIC_LENGTH);
+  return writer;
+}
+
+void lidx_trace_writer_close(lidx_trace_writer * writer)
+{
+  trace_writer_write_buffer(writer);
+  fclose(writer->writer_file);
+  delete writer;
+}
+
+uint64_t lidx_trace_writer_time(lidx_trace_writer * writer, uint64_t time_ns)
+{
+  if (time_ns < writer->writer_start_ns) {
+    return 0;
+  }
+  return time_ns - writer->writer_start_ns;
+}
+
+void lidx_trace_writer_add(lidx_trace_writer * writer, const lidx_trace_record & record)
+{
+  std::string value;
+  uint64_t start_delta = 0;
+  if (record.start_ns > writer->writer_last_start_ns) {
+    start_delta = record.start_ns - writer->writer_last_start_ns;
+    writer->writer_last_start_ns = record.start_ns;
+  }
+  lidx_encode_uint64(value, record.op);
+  lidx_encode_uint64(value, start_delta);
+  lidx_encode_uint64(value, record.duration_ns);
+  switch (record.op) {
+    case lidx_trace_op_set:
+      lidx_encode_uint64(value, record.doc);
+      lidx_encode_uint64(value, (record.tokenize_enabled ? LIDX_TRACE_FLAG_TOKENIZE : 0) |
+        (record.utf16 ? LIDX_TRACE_FLAG_UTF16 : 0));
+      lidx_encode_uint64(value, record.text.size());
+      value.append(record.text);
+      break;
+    case lidx_trace_op_remove:
+      lidx_encode_uint64(value, record.doc);
+      break;
+    case lidx_trace_op_search:
+      lidx_encode_uint64(value, record.kind);
+      lidx_encode_uint64(value, record.text.size());
+      value.append(record.text);
+      lidx_encode_uint64(value, record.count);
+      break;
+    case lidx_trace_op_flush:
+      break;
+  }
+  lidx_encode_uint64(writer->writer_buffer, value.size());
+  writer->writer_buffer.append(value);
+
+  if ((record.op == lidx_trace_op_flush) || (writer->writer_buffer.size() >= TRACE_WRITE_BUFFER_SIZE)) {
+    trace_writer_write_buffer(writer);
+  }
+}
+
+static void trace_writer_write_buffer(lidx_trace_writer * writer)
+{
+  if (writer->writer_buffer.size() == 0) {
+    return;
+  }
+  fwrite(writer->writer_buffer.data(), 1, writer->writer_buffer.size(), writer->writer_file);
+  fflush(writer->writer_file);
+  writer->writer_buffer.clear();
+}
+
+lidx_trace_reader * lidx_trace_reader_open(const char * filename)
+{
+  FILE * f = fopen(filename, "rb");
+  if (f == NULL) {
+    return NULL;
+  }
+  char magic[TRACE_MAGIC_LENGTH];
+  if ((fread(magic, 1, TRACE_MAGIC_LENGTH, f) != TRACE_MAGIC_LENGTH) ||
+    (memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LENGTH) != 0)) {
+    fclose(f);
+    return NULL;
+  }
+  lidx_trace_reader * reader = new lidx_trace_reader();
+  reader->reader_file = f;
+  reader->reader_last_start_ns = 0;
+  return reader;
+}
+
+void lidx_trace_reader_close(lidx_trace_reader * reader)
+{
+  fclose(reader->reader_file);
+  delete reader;
+}
+
+// Decodes a varint of the record. Returns -1 if it goes past the end of the record.
+static int trace_decode(std::string & buffer, size_t * p_position, uint64_t * p_value)
+{
+  if (* p_position >= buffer.size()) {
+    return -1;
+  }
+  * p_position = lidx_decode_uint64(buffer, * p_position, p_value);
+  if (* p_position > buffer.size()) {
+    return -1;
+  }
+  return 0;
+}
+
+static int trace_decode_string(std::string & buffer, size_t * p_position, std::string * p_value)
+{
+  uint64_t length;
+  if (trace_decode(buffer, p_position, &length) < 0) {
+    return -1;
+  }
+  if (length > buffer.size() - * p_position) {
+    return -1;
+  }
+  p_value->assign(buffer, * p_position, length);
+  * p_position += length;
+  return 0;
+}
+
+int lidx_trace_reader_next(lidx_trace_reader * reader, lidx_trace_record * p_record)
+{
+  // Reads the length of the record.
+  uint64_t length = 0;
+  int shift = 0;
+  while (1) {
+    int c = fgetc(reader->reader_file);
+    if (c == EOF) {
+      return (shift == 0) ? 0 : -1;
+    }
+    if (shift > 63) {
+      return -1;
+    }
+    length |= ((uint64_t) c & 0x7f) << shift;
+    shift += 7;
+    if ((c & 0x80) == 0) {
+      break;
+    }
+  }
+
+  if (length > TRACE_MAX_RECORD_SIZE) {
+    return -1;
+  }
+  std::string buffer;
+  buffer.resize(length);
+  if ((length > 0) && (fread(&buffer[0], 1, length, reader->reader_file) != length)) {
+    return -1;
+  }
+
+  size_t position = 0;
+  uint64_t op;
+  uint64_t start_delta;
+  uint64_t value;
+  if ((trace_decode(buffer, &position, &op) < 0) ||
+    (trace_decode(buffer, &position, &start_delta) < 0) ||
+    (trace_decode(buffer, &position, &p_record->duration_ns) < 0)) {
+    return -1;
+  }
+  reader->reader_last_start_ns += start_delta;
+  p_record->op = (lidx_trace_op) op;
+  p_record->start_ns = reader->reader_last_start_ns;
+  p_record->doc = 0;
+  p_record->tokenize_enabled = 0;
+  p_record->utf16 = 0;
+  p_record->kind = lidx_search_kind_prefix;
+  p_record->text.clear();
+  p_record->count = 0;
+  switch (op) {
+    case lidx_trace_op_set:
+      if ((trace_decode(buffer, &position, &p_record->doc) < 0) ||
+        (trace_decode(buffer, &position, &value) < 0) ||
+        (trace_decode_string(buffer, &position, &p_record->text) < 0)) {
+        return -1;
+      }
+      p_record->tokenize_enabled = (value & LIDX_TRACE_FLAG_TOKENIZE) != 0;
+      p_record->utf16 = (value & LIDX_TRACE_FLAG_UTF16) != 0;
+      break;
+    case lidx_trace_op_remove:
+      if (trace_decode(buffer, &position, &p_record->doc) < 0) {
+        return -1;
+      }
+      break;
+    case lidx_trace_op_search:
+      if ((trace_decode(buffer, &position, &value) < 0) ||
+        (trace_decode_string(buffer, &position, &p_record->text) < 0) ||
+        (trace_decode(buffer, &position, &p_record->count) < 0)) {
+        return -1;
+      }
+      if (value > lidx_search_kind_suffix) {
+        return -1;
+      }
+      p_record->kind = (lidx_search_kind) value;
+      break;
+    case lidx_trace_op_flush:
+      break;
+    default:
+      return -1;
+  }
+  return 1;
+}
@@ -0,0 +1,74 @@
+#ifndef LIDX_TRACE_H
+
+#define LIDX_TRACE_H
+
+#include <inttypes.h>
+
+#include <string>
+
+#include "lidx.h"
+
+// Trace of the calls made on an index, see `lidx_trace_start()`.
+//
+// The file starts with "LIDXTRC1" followed by the records. Each record is
+// its length followed by:
+// [operation], [start], [duration], [arguments]
+// `start` is the number of nanoseconds since the start of the previous
+// record, or since the start of the trace for the first one.
+// set: [doc], [flags], [text length], [UTF-8 text]
+// remove: [doc]
+// search: [kind], [token length], [UTF-8 token], [number of results]
+// An asynchronous search is recorded as a search from its start to the end
+// of its scan. The number of results of a truncated search is the number of
+// documents it found before it was stopped.
+// flush: no arguments
+// All the numbers are varints.
+// The flags of a set are `LIDX_TRACE_FLAG_TOKENIZE` when tokenization was
+// enabled and `LIDX_TRACE_FLAG_UTF16` when the text was given as UTF-16.
+
+typedef enum lidx_trace_op {
+  lidx_trace_op_set = 1,
+  lidx_trace_op_remove,
+  lidx_trace_op_search,
+  lidx_trace_op_flush,
+} lidx_trace_op;
+
+#define LIDX_TRACE_FLAG_TOKENIZE 1
+#define LIDX_TRACE_FLAG_UTF16 2
+
+struct lidx_trace_record {
+  lidx_trace_op op;
+  // Nanoseconds since the start of the trace.
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  uint64_t doc;
+  int tokenize_enabled;
+  // 1 if the text of a set was given as UTF-16. `text` is always UTF-8.
+  int utf16;
+  lidx_search_kind kind;
+  // Content of the document or searched token.
+  std::string text;
+  uint64_t count;
+};
+
+typedef struct lidx_trace_writer lidx_trace_writer;
+
+// Returns NULL if the file could not be created.
+lidx_trace_writer * lidx_trace_writer_open(const char * filename);
+void lidx_trace_writer_close(lidx_trace_writer * writer);
+// Converts a time returned by `lidx_stats_now_ns()` to a `start_ns` of the trace.
+uint64_t lidx_trace_writer_time(lidx_trace_writer * writer, uint64_t time_ns);
+// Records are buffered in memory and written to the file in large blocks,
+// and after each flush record.
+void lidx_trace_writer_add(lidx_trace_writer * writer, const lidx_trace_record & record);
+
+typedef struct lidx_trace_reader lidx_trace_reader;
+
+// Returns NULL if the file could not be opened or is not a trace.
+lidx_trace_reader * lidx_trace_reader_open(const char * filename);
+void lidx_trace_reader_close(lidx_trace_reader * reader);
+// Returns 1 when a record was read, 0 at the end of the trace and -1 if the
+// trace is truncated or corrupted.
+int lidx_trace_reader_next(lidx_trace_reader * reader, lidx_trace_record * p_record);
+
+#endif
@@ -1,39 +1,82 @@
 #include "lidx.h"
 
 #include <stdlib.h>
-
-#include <leveldb/db.h>
-#include <leveldb/status.h>
-#include <leveldb/write_batch.h>
+#include <string.h>
 
 #include "lidx-utils.h"
 #include "lidx-icu-utils.h"
 #include "lidx-encode.h"
+#include "lidx-keys.h"
+#include "lidx-tokenizer.h"
+#include "lidx-stats.h"
+#include "lidx-query-cache.h"
+#include "lidx-thread-pool.h"
+#include "lidx-complete.h"
+#include "lidx-storage.h"
+#include "lidx-dump.h"
+#include "lidx-trace.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <set>
 #include <map>
-
-#if __APPLE__
-#include <CoreFoundation/CoreFoundation.h>
-#endif
+#include <thread>
+#include <vector>
 
 static int db_put(lidx * index, std::string & key, std::string & value);
 static int db_get(lidx * index, std::string & key, std::string * p_value);
 static int db_delete(lidx * index, std::string & key);
 static int db_flush(lidx * index);
+static void buffer_gauges_add(lidx * index, int64_t keys, int64_t bytes);
+static void buffer_gauges_clear(lidx * index);
+static void invalidate_query_cache(lidx * index);
+static void invalidate_query_cache_key(lidx * index, const std::string & key);
+
+// Keys are described in lidx-keys.h.
+
+#define TOMBSTONES_CHUNK_BITS 10
+#define TOMBSTONES_CHUNK_SIZE ((1 << TOMBSTONES_CHUNK_BITS) / 8)
 
-// . -> next word id
-// ,[docid] -> [words ids]
-// /[word id] -> word
-// word -> [word id], [docs ids]
+// Substring and suffix searches on smaller indexes run on a single thread.
+#define SEARCH_PARALLEL_MIN_SIZE (4 * 1024 * 1024)
+// Number of keys scanned between two checks of the deadline of a search.
+#define SEARCH_STOP_CHECK_INTERVAL 64
 
 struct lidx {
-  leveldb::DB * lidx_db;
+  lidx_storage * lidx_db;
   std::map<std::string, std::string> * lidx_buffer;
   std::set<std::string> * lidx_buffer_dirty;
   std::set<std::string> * lidx_deleted;
+  // chunk -> bitmap, see \0t[docid / 1024].
+  std::map<uint64_t, std::string> * lidx_tombstones;
+  lidx_normalization lidx_normalization_mode;
+  // NULL when the query cache is disabled.
+  lidx_query_cache * lidx_cache;
+  // 0 uses one thread per core.
+  unsigned int lidx_search_threads;
+  // Changes of the number of documents of the words since the last flush.
+  std::map<std::string, int64_t> * lidx_frequency_deltas;
+  // NULL when the calls are not traced.
+  lidx_trace_writer * lidx_trace;
+  // 1 when a vacuum was interrupted, see \0v.
+  int lidx_vacuum_pending;
+  // Size of the keys and the values waiting to be flushed.
+  int64_t lidx_buffer_bytes;
 };
 
+static int open_storage(lidx * index, lidx_storage * storage);
+static int load_storage(lidx * index);
+static int check_normalization(lidx * index);
+static int load_tombstones(lidx * index);
+static int build_completion(lidx * index);
+static void add_word_frequency(lidx * index, const std::string & word, int64_t delta);
+static int update_completion(lidx * index);
+static int is_tombstone(lidx * index, uint64_t doc);
+static void trace_add(lidx * index, lidx_trace_record * record, uint64_t start, uint64_t end);
+static int set_tombstone(lidx * index, uint64_t doc, int removed);
+static void tombstones_key(std::string & key, uint64_t chunk);
+
 lidx * lidx_new(void)
 {
   lidx_init_icu_utils();
@@ -41,31 +84,121 @@ lidx * lidx_new(void)
   result->lidx_buffer = new std::map<std::string, std::string>();
   result->lidx_buffer_dirty = new std::set<std::string>();
   result->lidx_deleted = new std::set<std::string>();
+  result->lidx_tombstones = new std::map<uint64_t, std::string>();
+  result->lidx_frequency_deltas = new std::map<std::string, int64_t>();
   return result;
 }
 
 void lidx_free(lidx * index)
 {
+  buffer_gauges_clear(index);
   delete index->lidx_buffer;
   delete index->lidx_buffer_dirty;
   delete index->lidx_deleted;
+  delete index->lidx_tombstones;
+  delete index->lidx_frequency_deltas;
+  if (index->lidx_cache != NULL) {
+    lidx_query_cache_free(index->lidx_cache);
+  }
+  lidx_trace_stop(index);
   free(index);
 }
 
+void lidx_set_normalization(lidx * index, lidx_normalization normalization)
+{
+  index->lidx_normalization_mode = normalization;
+}
+
+void lidx_set_query_cache_size(lidx * index, size_t max_size)
+{
+  if (index->lidx_cache != NULL) {
+    lidx_query_cache_free(index->lidx_cache);
+    index->lidx_cache = NULL;
+  }
+  if (max_size != 0) {
+    index->lidx_cache = lidx_query_cache_new(max_size);
+  }
+}
+
 int lidx_open(lidx * index, const char * filename)
 {
-  leveldb::Options options;
-  leveldb::Status status;
+  lidx_storage * storage = lidx_storage_leveldb_open(filename);
+  if (storage == NULL) {
+    return -1;
+  }
+  return open_storage(index, storage);
+}
+
+int lidx_open_memory(lidx * index)
+{
+  return open_storage(index, lidx_storage_memory_new());
+}
 
-  options.create_if_missing = true;
-  status = leveldb::DB::Open(options, filename, &index->lidx_db);
-  if (!status.ok()) {
+static int open_storage(lidx * index, lidx_storage * storage)
+{
+  index->lidx_db = storage;
+  if (load_storage(index) < 0) {
+    // The index is closed without writing the keys changed while loading it.
+    buffer_gauges_clear(index);
+    index->lidx_buffer->clear();
+    index->lidx_buffer_dirty->clear();
+    index->lidx_deleted->clear();
+    index->lidx_frequency_deltas->clear();
+    lidx_close(index);
     return -1;
   }
-  
   return 0;
 }
 
+// Reads the state kept in memory and finishes an interrupted vacuum.
+static int load_storage(lidx * index)
+{
+  if (check_normalization(index) < 0) {
+    return -1;
+  }
+  if (load_tombstones(index) < 0) {
+    return -1;
+  }
+  std::string key;
+  std::string value;
+  lidx_metadata_key(key, LIDX_METADATA_VACUUM);
+  int r = index->lidx_db->get(key, &value);
+  if (r < -1) {
+    return -1;
+  }
+  index->lidx_vacuum_pending = (r == 0);
+  if (index->lidx_vacuum_pending && (lidx_vacuum(index) < 0)) {
+    return -1;
+  }
+  return build_completion(index);
+}
+
+// Stores the normalization in a new index. Returns -1 if the index uses
+// another normalization.
+static int check_normalization(lidx * index)
+{
+  std::string key;
+  std::string value;
+  lidx_metadata_key(key, LIDX_METADATA_NORMALIZATION);
+  int r = index->lidx_db->get(key, &value);
+  if (r < -1) {
+    return -1;
+  }
+  if (r == 0) {
+    uint64_t normalization;
+    if ((value.size() == 0) || (lidx_decode_uint64(value, 0, &normalization) > value.size())) {
+      return -1;
+    }
+    return (normalization == (uint64_t) index->lidx_normalization_mode) ? 0 : -1;
+  }
+  
+  lidx_encode_uint64(value, index->lidx_normalization_mode);
+  lidx_storage_batch batch;
+  lidx_storage_batch_init(&batch);
+  lidx_storage_batch_put(&batch, key, value);
+  return index->lidx_db->write(&batch);
+}
+
 void lidx_close(lidx * index)
 {
   if (index->lidx_db == NULL) {
@@ -74,11 +207,50 @@ void lidx_close(lidx * index)
   db_flush(index);
   delete index->lidx_db;
   index->lidx_db = NULL;
+  index->lidx_tombstones->clear();
+  index->lidx_vacuum_pending = 0;
+  if (index->lidx_cache != NULL) {
+    lidx_query_cache_invalidate_all(index->lidx_cache);
+  }
 }
 
 int lidx_flush(lidx * index)
 {
-  return db_flush(index);
+  uint64_t start = lidx_stats_now_ns();
+  int result = db_flush(index);
+  if (index->lidx_trace != NULL) {
+    lidx_trace_record record;
+    record.op = lidx_trace_op_flush;
+    trace_add(index, &record, start, lidx_stats_now_ns());
+  }
+  return result;
+}
+
+int lidx_trace_start(lidx * index, const char * filename)
+{
+  lidx_trace_stop(index);
+  index->lidx_trace = lidx_trace_writer_open(filename);
+  if (index->lidx_trace == NULL) {
+    return -1;
+  }
+  return 0;
+}
+
+void lidx_trace_stop(lidx * index)
+{
+  if (index->lidx_trace == NULL) {
+    return;
+  }
+  lidx_trace_writer_close(index->lidx_trace);
+  index->lidx_trace = NULL;
+}
+
+// Records a call that ran from `start` to `end`, see `lidx_stats_now_ns()`.
+static void trace_add(lidx * index, lidx_trace_record * record, uint64_t start, uint64_t end)
+{
+  record->start_ns = lidx_trace_writer_time(index->lidx_trace, start);
+  record->duration_ns = end - start;
+  lidx_trace_writer_add(index->lidx_trace, * record);
 }
 
 //int lidx_set(lidx * index, uint64_t doc, const char * text);
@@ -86,9 +258,14 @@ int lidx_flush(lidx * index)
 // word -> append doc id to docs ids
 // store doc id -> words ids
 
-static int tokenize(lidx * index, uint64_t doc, const UChar * text, int tokenize_enabled);
+static int set_document(lidx * index, uint64_t doc, const char * text, const UChar * utext,
+    int tokenize_enabled);
+static int tokenize(lidx * index, uint64_t doc, const char * text, const UChar * utext,
+    int tokenize_enabled, std::set<uint64_t> * previous_wordsids_set);
 static int add_to_indexer(lidx * index, uint64_t doc, const char * word,
-    std::set<uint64_t> & wordsids_set);
+    std::set<uint64_t> & wordsids_set, std::set<uint64_t> * previous_wordsids_set);
+static std::string get_word_for_wordid(lidx * index, uint64_t wordid);
+static int remove_docid_in_word(lidx * index, std::string word, uint64_t doc);
 
 int lidx_set(lidx * index, uint64_t doc, const char * text)
 {
@@ -97,10 +274,7 @@ int lidx_set(lidx * index, uint64_t doc, const char * text)
 
 int lidx_set2(lidx * index, uint64_t doc, const char * text, int tokenize_enabled)
 {
-  UChar * utext = lidx_from_utf8(text);
-  int result = lidx_u_set2(index, doc, utext, tokenize_enabled);
-  free((void *) utext);
-  return result;
+  return set_document(index, doc, text, NULL, tokenize_enabled);
 }
 
 int lidx_u_set(lidx * index, uint64_t doc, const UChar * utext)
@@ -108,100 +282,144 @@ int lidx_u_set(lidx * index, uint64_t doc, const UChar * utext)
     return lidx_u_set2(index, doc, utext, 1);
 }
 
+static int update_document(lidx * index, uint64_t doc, const char * text, const UChar * utext,
+    int tokenize_enabled);
+
 int lidx_u_set2(lidx * index, uint64_t doc, const UChar * utext, int tokenize_enabled)
 {
-  int r = lidx_remove(index, doc);
-  if (r < 0) {
-    return r;
+  return set_document(index, doc, NULL, utext, tokenize_enabled);
+}
+
+// Either `text` (UTF-8) or `utext` (UTF-16) is set.
+static int set_document(lidx * index, uint64_t doc, const char * text, const UChar * utext,
+    int tokenize_enabled)
+{
+  uint64_t start = lidx_stats_now_ns();
+  int result = update_document(index, doc, text, utext, tokenize_enabled);
+  uint64_t end = lidx_stats_now_ns();
+  lidx_stats_add(lidx_stats_counter_set_count, 1);
+  lidx_stats_record(lidx_stats_histogram_set_latency_us, (end - start) / 1000);
+  if (index->lidx_trace != NULL) {
+    lidx_trace_record record;
+    record.op = lidx_trace_op_set;
+    record.doc = doc;
+    record.tokenize_enabled = tokenize_enabled;
+    record.utf16 = (text == NULL);
+    if (text != NULL) {
+      record.text = text;
+    }
+    else {
+      char * utf8_text = lidx_to_utf8(utext);
+      record.text = utf8_text;
+      free(utf8_text);
+    }
+    trace_add(index, &record, start, end);
+  }
+  return result;
+}
+
+static int update_document(lidx * index, uint64_t doc, const char * text, const UChar * utext,
+    int tokenize_enabled)
+{
+  if (index->lidx_vacuum_pending && (lidx_vacuum(index) < 0)) {
+    return -1;
+  }
+  
+  // When the document is already indexed, only the words that were added or
+  // removed are updated.
+  std::string key(",");
+  lidx_encode_uint64(key, doc);
+  std::string str;
+  int r = db_get(index, key, &str);
+  if (r < -1) {
+    return -1;
+  }
+  if ((r == -1) && is_tombstone(index, doc)) {
+    // The words of the removed document are not in the index any more.
+    if (set_tombstone(index, doc, 0) < 0) {
+      return -1;
+    }
+  }
+  if ((r == 0) && is_tombstone(index, doc)) {
+    // The words of the removed document are still in the index and in the
+    // frequencies. They will be updated as for an existing document.
+    r = set_tombstone(index, doc, 0);
+    if (r < 0) {
+      return r;
+    }
+    r = 0;
+  }
+  std::set<uint64_t> previous_wordsids_set;
+  size_t position = 0;
+  while (position < str.size()) {
+    uint64_t wordid;
+    position = lidx_decode_uint64(str, position, &wordid);
+    previous_wordsids_set.insert(wordid);
   }
-  r = tokenize(index, doc, utext, tokenize_enabled);
+  r = tokenize(index, doc, text, utext, tokenize_enabled, (r == 0) ? &previous_wordsids_set : NULL);
   if (r < 0) {
     return r;
   }
   return 0;
 }
 
-static int tokenize(lidx * index, uint64_t doc, const UChar * text, int tokenize_enabled)
+struct tokenize_context {
+  lidx * index;
+  uint64_t doc;
+  std::set<uint64_t> * wordsids_set;
+  std::set<uint64_t> * previous_wordsids_set;
+  uint64_t tokens_count;
+};
+
+static int tokenize_callback(const char * word, void * context)
 {
-  int result = 0;
-  std::set<uint64_t> wordsids_set;
-  if (tokenize_enabled) {
-#if __APPLE__
-    unsigned int len = lidx_u_get_length(text);
-    CFStringRef str = CFStringCreateWithBytes(NULL, (const UInt8 *) text, len * sizeof(* text), kCFStringEncodingUTF16LE, false);
-    CFStringTokenizerRef tokenizer = CFStringTokenizerCreate(NULL, str, CFRangeMake(0, len), kCFStringTokenizerUnitWord, NULL);
-    while (1) {
-      CFStringTokenizerTokenType wordKind = CFStringTokenizerAdvanceToNextToken(tokenizer);
-      if (wordKind == kCFStringTokenizerTokenNone) {
-        break;
-      }
-      if (wordKind == kCFStringTokenizerTokenHasNonLettersMask) {
-        continue;
-      }
-      CFRange range = CFStringTokenizerGetCurrentTokenRange(tokenizer);
-      char * transliterated = lidx_transliterate(&text[range.location], (int) range.length);
-      if (transliterated == NULL) {
-        continue;
-      }
-      int r = add_to_indexer(index, doc, transliterated, wordsids_set);
-      if (r < 0) {
-        result = r;
-        break;
-      }
-    
-      free(transliterated);
-    }
-    CFRelease(str);
-    CFRelease(tokenizer);
-#else
-    UErrorCode status;
-    status = U_ZERO_ERROR;
-    UBreakIterator * iterator = ubrk_open(UBRK_WORD, NULL, text, u_strlen(text), &status);
-    LIDX_ASSERT(status <= U_ZERO_ERROR);
-  
-    int32_t left = 0;
-    int32_t right = 0;
-    int word_kind = 0;
-    ubrk_first(iterator);
-
-    while (1) {
-      left = right;
-      right = ubrk_next(iterator);
-      if (right == UBRK_DONE) {
-        break;
-      }
+  struct tokenize_context * tokenize_context = (struct tokenize_context *) context;
+  tokenize_context->tokens_count ++;
+  return add_to_indexer(tokenize_context->index, tokenize_context->doc, word, * tokenize_context->wordsids_set,
+    tokenize_context->previous_wordsids_set);
+}
 
-      word_kind = ubrk_getRuleStatus(iterator);
-      if (word_kind == 0) {
-        // skip punctuation and space.
+// `previous_wordsids_set` is the list of words of the document if it was already indexed, NULL otherwise.
+static int tokenize(lidx * index, uint64_t doc, const char * text, const UChar * utext,
+    int tokenize_enabled, std::set<uint64_t> * previous_wordsids_set)
+{
+  std::set<uint64_t> wordsids_set;
+  struct tokenize_context context;
+  context.index = index;
+  context.doc = doc;
+  context.wordsids_set = &wordsids_set;
+  context.previous_wordsids_set = previous_wordsids_set;
+  context.tokens_count = 0;
+  int result;
+  if (text != NULL) {
+    result = lidx_tokenize_utf8(text, tokenize_enabled, index->lidx_normalization_mode, tokenize_callback, &context);
+  }
+  else {
+    result = lidx_tokenize(utext, tokenize_enabled, index->lidx_normalization_mode, tokenize_callback, &context);
+  }
+  lidx_stats_add(lidx_stats_counter_tokens_count, context.tokens_count);
+  lidx_stats_record(lidx_stats_histogram_tokens_per_document, context.tokens_count);
+  
+  if (previous_wordsids_set != NULL) {
+    // Removes the document from the words that are not in the document any more.
+    for(std::set<uint64_t>::iterator wordsids_set_iterator = previous_wordsids_set->begin() ; wordsids_set_iterator != previous_wordsids_set->end() ; ++ wordsids_set_iterator) {
+      if (wordsids_set.find(* wordsids_set_iterator) != wordsids_set.end()) {
         continue;
       }
-
-      char * transliterated = lidx_transliterate(&text[left], right - left);
-      if (transliterated == NULL) {
+      std::string word = get_word_for_wordid(index, * wordsids_set_iterator);
+      if (word.size() == 0) {
         continue;
       }
-      int r = add_to_indexer(index, doc, transliterated, wordsids_set);
+      int r = remove_docid_in_word(index, word, doc);
       if (r < 0) {
-        result = r;
-        break;
+        return -1;
       }
-
-      free(transliterated);
     }
-    ubrk_close(iterator);
-#endif
-  }
-  else {
-    char * transliterated = lidx_transliterate(text, lidx_u_get_length(text));
-    if (transliterated != NULL) {
-      int r = add_to_indexer(index, doc, transliterated, wordsids_set);
-      if (r < 0) {
-        result = r;
-      }
+    if (* previous_wordsids_set == wordsids_set) {
+      return result;
     }
-    free(transliterated);
   }
+  
   std::string key(",");
   lidx_encode_uint64(key, doc);
   
@@ -218,24 +436,36 @@ static int tokenize(lidx * index, uint64_t doc, const UChar * text, int tokenize
 }
 
 static int add_to_indexer(lidx * index, uint64_t doc, const char * word,
-    std::set<uint64_t> & wordsids_set)
+    std::set<uint64_t> & wordsids_set, std::set<uint64_t> * previous_wordsids_set)
 {
   std::string word_str(word);
+  std::string word_key;
   std::string value;
   uint64_t wordid;
   
-  int r = db_get(index, word_str, &value);
+  lidx_word_key(word_key, word_str);
+  int r = db_get(index, word_key, &value);
   if (r < -1) {
     return -1;
   }
   if (r == 0) {
     // Adding doc id to existing entry.
     lidx_decode_uint64(value, 0, &wordid);
+    if (wordsids_set.find(wordid) != wordsids_set.end()) {
+      // The word has already been seen in this document.
+      return 0;
+    }
+    if ((previous_wordsids_set != NULL) && (previous_wordsids_set->find(wordid) != previous_wordsids_set->end())) {
+      // The document is already in the list.
+      wordsids_set.insert(wordid);
+      return 0;
+    }
     lidx_encode_uint64(value, doc);
-    int r = db_put(index, word_str, value);
+    int r = db_put(index, word_key, value);
     if (r < 0) {
       return r;
     }
+    add_word_frequency(index, word_str, 1);
   }
   else /* r == -1 */ {
     // Not found.
@@ -270,7 +500,7 @@ static int add_to_indexer(lidx * index, uint64_t doc, const char * word,
     std::string value_str;
     lidx_encode_uint64(value_str, wordid);
     lidx_encode_uint64(value_str, doc);
-    r = db_put(index, word_str, value_str);
+    r = db_put(index, word_key, value_str);
     if (r < 0) {
       return r;
     }
@@ -281,6 +511,7 @@ static int add_to_indexer(lidx * index, uint64_t doc, const char * word,
     if (r < 0) {
       return r;
     }
+    add_word_frequency(index, word_str, 1);
   }
   
   wordsids_set.insert(wordid);
@@ -289,41 +520,48 @@ static int add_to_indexer(lidx * index, uint64_t doc, const char * word,
 }
 
 //int lidx_remove(lidx * index, uint64_t doc);
-// docid -> words ids -> remove docid from word
-// if docs ids for word is empty, we remove the word id
+// docid -> tombstone
+// The document stays in the words until `lidx_vacuum()` is called.
 
-static std::string get_word_for_wordid(lidx * index, uint64_t wordid);
-static int remove_docid_in_word(lidx * index, std::string word, uint64_t doc);
 static int remove_word(lidx * index, std::string word, uint64_t wordid);
+static int remove_document(lidx * index, uint64_t doc);
 
 int lidx_remove(lidx * index, uint64_t doc)
 {
+  uint64_t start = lidx_stats_now_ns();
+  int result = remove_document(index, doc);
+  if (index->lidx_trace != NULL) {
+    lidx_trace_record record;
+    record.op = lidx_trace_op_remove;
+    record.doc = doc;
+    trace_add(index, &record, start, lidx_stats_now_ns());
+  }
+  return result;
+}
+
+static int remove_document(lidx * index, uint64_t doc)
+{
+  lidx_stats_add(lidx_stats_counter_remove_count, 1);
+  if (index->lidx_vacuum_pending && (lidx_vacuum(index) < 0)) {
+    return -1;
+  }
   std::string key(",");
   lidx_encode_uint64(key, doc);
   std::string str;
   int r = db_get(index, key, &str);
   if (r == -1) {
-    // do nothing
+    return 0;
   }
   else if (r < 0) {
     return -1;
   }
-  
-  size_t position = 0;
-  while (position < str.size()) {
-    uint64_t wordid;
-    position = lidx_decode_uint64(str, position, &wordid);
-    std::string word = get_word_for_wordid(index, wordid);
-    if (word.size() == 0) {
-      continue;
-    }
-    int r = remove_docid_in_word(index, word, doc);
-    if (r < 0) {
-      return -1;
-    }
+  if (is_tombstone(index, doc)) {
+    return 0;
   }
   
-  return 0;
+  // The removed document counts in the frequencies of its words until
+  // `lidx_vacuum()` removes it from the words.
+  return set_tombstone(index, doc, 1);
 }
 
 static std::string get_word_for_wordid(lidx * index, uint64_t wordid)
@@ -340,8 +578,10 @@ static std::string get_word_for_wordid(lidx * index, uint64_t wordid)
 
 static int remove_docid_in_word(lidx * index, std::string word, uint64_t doc)
 {
+  std::string word_key;
   std::string str;
-  int r = db_get(index, word, &str);
+  lidx_word_key(word_key, word);
+  int r = db_get(index, word_key, &str);
   if (r == -1) {
     return 0;
   }
@@ -352,15 +592,25 @@ static int remove_docid_in_word(lidx * index, std::string word, uint64_t doc)
   uint64_t wordid;
   std::string buffer;
   size_t position = 0;
+  int has_docid = 0;
+  int found = 0;
   position = lidx_decode_uint64(str, position, &wordid);
-  while (position < buffer.size()) {
+  lidx_encode_uint64(buffer, wordid);
+  while (position < str.size()) {
     uint64_t current_docid;
     position = lidx_decode_uint64(str, position, &current_docid);
     if (current_docid != doc) {
       lidx_encode_uint64(buffer, current_docid);
+      has_docid = 1;
+    }
+    else {
+      found = 1;
     }
   }
-  if (buffer.size() == 0) {
+  if (found) {
+    add_word_frequency(index, word, -1);
+  }
+  if (!has_docid) {
     // remove word entry
     int r = remove_word(index, word, wordid);
     if (r < 0) {
@@ -369,7 +619,7 @@ static int remove_docid_in_word(lidx * index, std::string word, uint64_t doc)
   }
   else {
     // update word entry
-    int r = db_put(index, word, buffer);
+    int r = db_put(index, word_key, buffer);
     if (r < 0) {
       return r;
     }
@@ -387,7 +637,9 @@ static int remove_word(lidx * index, std::string word, uint64_t wordid)
   if (r < 0) {
     return -1;
   }
-  r = db_delete(index, word);
+  std::string word_key;
+  lidx_word_key(word_key, word);
+  r = db_delete(index, word_key);
   if (r < 0) {
     return -1;
   }
@@ -407,49 +659,297 @@ int lidx_search(lidx * index, const char * token, lidx_search_kind kind, uint64_
   return result;
 }
 
+// Word keys can't start with the characters used by the other keys: \0 , . /
+// The words that start with them are escaped, see lidx-keys.h.
+// The searches only scan ["\1", ",") , ["-", ".") and ["0", end).
+
+// Documents ids found in a range of keys.
+struct search_range_result {
+  std::vector<uint64_t> docsids;
+  uint64_t keys_scanned;
+  uint64_t keys_matched;
+  // 1 when the scan stopped before the end of the range.
+  int truncated;
+};
+
+// Deadline and cancellation of an asynchronous search.
+struct search_stop_condition {
+  // 0 when the search has no deadline.
+  uint64_t deadline_ns;
+  std::atomic<int> cancelled;
+};
+
+struct lidx_search_handle {
+  lidx * search_index;
+  std::string search_token;
+  lidx_search_kind search_kind;
+  search_stop_condition search_stop;
+  search_range_result search_result;
+  uint64_t search_start_ns;
+  uint64_t search_end_ns;
+  // 1 when the calls were traced at the start of the search.
+  int search_traced;
+  // UTF-8 token, kept when the search is traced.
+  std::string search_trace_token;
+  // NULL when the result was found in the query cache.
+  std::thread * search_thread;
+  std::atomic<int> search_done;
+  lidx_search_callback search_callback;
+  void * search_callback_context;
+};
+
+static void search_run(lidx * index, const std::string & token, lidx_search_kind kind,
+    const search_stop_condition * stop, search_range_result * p_result);
+static void search_scan_range(lidx * index, const lidx_storage_snapshot * snapshot,
+    const std::string & start, const std::string & limit,
+    const std::string & token, lidx_search_kind kind,
+    const search_stop_condition * stop, search_range_result * p_result);
+static void search_scan_ranges(lidx * index, const std::string & token, lidx_search_kind kind,
+    const search_stop_condition * stop, search_range_result * p_result);
+static int search_split_ranges(lidx * index, unsigned int count,
+    std::vector<std::pair<std::string, std::string> > * p_ranges);
+static void search_record_stats(uint64_t start, const search_range_result & range_result);
+static void search_copy_result(const std::vector<uint64_t> & docsids, uint64_t ** p_docsids, size_t * p_count);
+static int search_token(lidx * index, const UChar * utoken, lidx_search_kind kind,
+    uint64_t ** p_docsids, size_t * p_count);
+
 int lidx_u_search(lidx * index, const UChar * utoken, lidx_search_kind kind,
     uint64_t ** p_docsids, size_t * p_count)
 {
+  uint64_t start = lidx_stats_now_ns();
+  int result = search_token(index, utoken, kind, p_docsids, p_count);
+  if (index->lidx_trace != NULL) {
+    uint64_t end = lidx_stats_now_ns();
+    lidx_trace_record record;
+    record.op = lidx_trace_op_search;
+    record.kind = kind;
+    char * utf8_token = lidx_to_utf8(utoken);
+    record.text = utf8_token;
+    free(utf8_token);
+    record.count = (result == 0) ? * p_count : 0;
+    trace_add(index, &record, start, end);
+  }
+  return result;
+}
+
+static int search_token(lidx * index, const UChar * utoken, lidx_search_kind kind,
+    uint64_t ** p_docsids, size_t * p_count)
+{
+  uint64_t start = lidx_stats_now_ns();
+  db_flush(index);
+  
+  char * transliterated = lidx_normalize(utoken, -1, index->lidx_normalization_mode);
+  
+  if (index->lidx_cache != NULL) {
+    std::vector<uint64_t> cached_docsids;
+    if (lidx_query_cache_get(index->lidx_cache, transliterated, kind, &cached_docsids) == 0) {
+      free(transliterated);
+      search_copy_result(cached_docsids, p_docsids, p_count);
+      lidx_stats_add(lidx_stats_counter_search_count, 1);
+      lidx_stats_record(lidx_stats_histogram_search_latency_us, (lidx_stats_now_ns() - start) / 1000);
+      return 0;
+    }
+  }
+  
+  search_range_result range_result;
+  search_run(index, transliterated, kind, NULL, &range_result);
+  if (index->lidx_cache != NULL) {
+    lidx_query_cache_put(index->lidx_cache, transliterated, kind, range_result.docsids);
+  }
+  free(transliterated);
+  
+  search_copy_result(range_result.docsids, p_docsids, p_count);
+  search_record_stats(start, range_result);
+  
+  return 0;
+}
+
+//lidx_search_handle * lidx_search_start(lidx * index, const char * token, ...);
+// The index is flushed and the query cache is used on the calling thread.
+// Only the scan runs on the thread of the search.
+
+lidx_search_handle * lidx_search_start(lidx * index, const char * token, lidx_search_kind kind,
+    unsigned int timeout_ms, lidx_search_callback callback, void * context)
+{
+  lidx_search_handle * result;
+  UChar * utoken = lidx_from_utf8(token);
+  result = lidx_u_search_start(index, utoken, kind, timeout_ms, callback, context);
+  free((void *) utoken);
+  return result;
+}
+
+lidx_search_handle * lidx_u_search_start(lidx * index, const UChar * utoken, lidx_search_kind kind,
+    unsigned int timeout_ms, lidx_search_callback callback, void * context)
+{
+  lidx_search_handle * search = new lidx_search_handle();
+  search->search_index = index;
+  search->search_kind = kind;
+  search->search_start_ns = lidx_stats_now_ns();
+  search->search_stop.deadline_ns = 0;
+  if (timeout_ms > 0) {
+    search->search_stop.deadline_ns = search->search_start_ns + (uint64_t) timeout_ms * 1000000;
+  }
+  search->search_stop.cancelled = 0;
+  search->search_result.keys_scanned = 0;
+  search->search_result.keys_matched = 0;
+  search->search_result.truncated = 0;
+  search->search_thread = NULL;
+  search->search_done = 0;
+  search->search_callback = callback;
+  search->search_callback_context = context;
+  search->search_traced = (index->lidx_trace != NULL);
+  if (search->search_traced) {
+    char * utf8_token = lidx_to_utf8(utoken);
+    search->search_trace_token = utf8_token;
+    free(utf8_token);
+  }
+  
   db_flush(index);
+  char * transliterated = lidx_normalize(utoken, -1, index->lidx_normalization_mode);
+  search->search_token = transliterated;
+  free(transliterated);
+  
+  if ((index->lidx_cache != NULL) &&
+    (lidx_query_cache_get(index->lidx_cache, search->search_token, kind, &search->search_result.docsids) == 0)) {
+    search->search_end_ns = lidx_stats_now_ns();
+    lidx_stats_add(lidx_stats_counter_search_count, 1);
+    lidx_stats_record(lidx_stats_histogram_search_latency_us, (search->search_end_ns - search->search_start_ns) / 1000);
+    search->search_done = 1;
+    if (callback != NULL) {
+      callback(search, context);
+    }
+    return search;
+  }
   
-  char * transliterated = lidx_transliterate(utoken, -1);
-  unsigned int transliterated_length = (unsigned int) strlen(transliterated);
-  std::set<uint64_t> result_set;
+  search->search_thread = new std::thread([search]() {
+    search_run(search->search_index, search->search_token, search->search_kind, &search->search_stop, &search->search_result);
+    search->search_end_ns = lidx_stats_now_ns();
+    search_record_stats(search->search_start_ns, search->search_result);
+    search->search_done = 1;
+    if (search->search_callback != NULL) {
+      search->search_callback(search, search->search_callback_context);
+    }
+  });
+  return search;
+}
+
+void lidx_search_cancel(lidx_search_handle * search)
+{
+  search->search_stop.cancelled = 1;
+}
+
+int lidx_search_is_done(lidx_search_handle * search)
+{
+  return search->search_done;
+}
+
+int lidx_search_finish(lidx_search_handle * search, uint64_t ** p_docsids, size_t * p_count,
+    int * p_truncated)
+{
+  lidx * index = search->search_index;
+  if (search->search_thread != NULL) {
+    search->search_thread->join();
+    delete search->search_thread;
+    if ((index->lidx_cache != NULL) && !search->search_result.truncated) {
+      lidx_query_cache_put(index->lidx_cache, search->search_token, search->search_kind, search->search_result.docsids);
+    }
+  }
   
-  leveldb::ReadOptions options;
-  leveldb::Iterator * iterator = index->lidx_db->NewIterator(options);
+  search_copy_result(search->search_result.docsids, p_docsids, p_count);
+  if (p_truncated != NULL) {
+    * p_truncated = search->search_result.truncated;
+  }
+  // The search is recorded on the calling thread, when it's finished.
+  if ((index->lidx_trace != NULL) && search->search_traced) {
+    lidx_trace_record record;
+    record.op = lidx_trace_op_search;
+    record.kind = search->search_kind;
+    record.text = search->search_trace_token;
+    record.count = search->search_result.docsids.size();
+    trace_add(index, &record, search->search_start_ns, search->search_end_ns);
+  }
+  delete search;
+  
+  return 0;
+}
+
+void lidx_set_search_threads(lidx * index, unsigned int count)
+{
+  index->lidx_search_threads = count;
+}
+
+// Stores the sorted documents ids that match the normalized token in `* p_result`.
+// `stop` is NULL when the search can't be stopped.
+static void search_run(lidx * index, const std::string & token, lidx_search_kind kind,
+    const search_stop_condition * stop, search_range_result * p_result)
+{
+  p_result->keys_scanned = 0;
+  p_result->keys_matched = 0;
+  p_result->truncated = 0;
   if (kind == lidx_search_kind_prefix) {
-    iterator->Seek(transliterated);
+    std::string start;
+    lidx_word_key(start, token);
+    search_scan_range(index, NULL, start, std::string(), token, kind, stop, p_result);
   }
   else {
-    iterator->SeekToFirst();
+    search_scan_ranges(index, token, kind, stop, p_result);
   }
-  while (iterator->Valid()) {
-    int add_to_result = 0;
+  std::vector<uint64_t> & docsids = p_result->docsids;
+  std::sort(docsids.begin(), docsids.end());
+  docsids.erase(std::unique(docsids.begin(), docsids.end()), docsids.end());
+}
+
+static inline int search_should_stop(const search_stop_condition * stop)
+{
+  if (stop->cancelled) {
+    return 1;
+  }
+  return (stop->deadline_ns != 0) && (lidx_stats_now_ns() >= stop->deadline_ns);
+}
+
+// Scans the words in [start, limit). An empty `limit` is the end of the keys.
+// A prefix search stops at the first word that doesn't match.
+static void search_scan_range(lidx * index, const lidx_storage_snapshot * snapshot,
+    const std::string & start, const std::string & limit,
+    const std::string & token, lidx_search_kind kind,
+    const search_stop_condition * stop, search_range_result * p_result)
+{
+  lidx_storage_iterator * iterator = index->lidx_db->new_iterator(snapshot);
+  for(iterator->seek(start) ; iterator->is_valid() ; iterator->next()) {
+    leveldb::Slice key = iterator->key();
+    if ((limit.size() > 0) && (key.compare(limit) >= 0)) {
+      break;
+    }
+    if ((stop != NULL) && (p_result->keys_scanned % SEARCH_STOP_CHECK_INTERVAL == 0) && search_should_stop(stop)) {
+      p_result->truncated = 1;
+      break;
+    }
     
-    if (iterator->key().starts_with(".") || iterator->key().starts_with(",") || iterator->key().starts_with("/")) {
-      iterator->Next();
+    int add_to_result = 0;
+    p_result->keys_scanned ++;
+    if (!lidx_is_word_key(key)) {
       continue;
     }
+    leveldb::Slice word = lidx_key_word(key);
     if (kind == lidx_search_kind_prefix) {
-      if (!iterator->key().starts_with(transliterated)) {
+      if (!word.starts_with(token)) {
         break;
       }
       add_to_result = 1;
     }
     else if (kind == lidx_search_kind_substr) {
-      if (iterator->key().ToString().find(transliterated) != -1) {
+      if (std::search(word.data(), word.data() + word.size(), token.begin(), token.end()) != word.data() + word.size()) {
         add_to_result = 1;
       }
     }
     else if (kind == lidx_search_kind_suffix) {
-      std::string key = iterator->key().ToString();
-      if ((key.length() >= transliterated_length) &&
-        (key.compare(key.length() - transliterated_length, transliterated_length, transliterated) == 0)) {
+      if ((word.size() >= token.size()) &&
+        (memcmp(word.data() + word.size() - token.size(), token.data(), token.size()) == 0)) {
         add_to_result = 1;
       }
     }
     if (add_to_result) {
+      p_result->keys_matched ++;
       size_t position = 0;
       uint64_t wordid;
       std::string value_str = iterator->value().ToString();
@@ -457,54 +957,985 @@ int lidx_u_search(lidx * index, const UChar * utoken, lidx_search_kind kind,
       while (position < value_str.size()) {
         uint64_t docid;
         position = lidx_decode_uint64(value_str, position, &docid);
-        result_set.insert(docid);
+        if (is_tombstone(index, docid)) {
+          continue;
+        }
+        p_result->docsids.push_back(docid);
       }
     }
-    
-    iterator->Next();
-  }
-  free(transliterated);
-  
-  uint64_t * result = (uint64_t *) calloc(result_set.size(), sizeof(* result));
-  unsigned int count = 0;
-  for(std::set<uint64_t>::iterator set_iterator = result_set.begin() ; set_iterator != result_set.end() ; ++ set_iterator) {
-    result[count] = * set_iterator;
-    count ++;
   }
-  
-  * p_docsids = result;
-  * p_count = count;
-  
-  return 0;
+  delete iterator;
 }
 
-static int db_put(lidx * index, std::string & key, std::string & value)
+// Substring and suffix searches scan all the words. The keys are split in
+// ranges of about the same size on disk, scanned in parallel on a snapshot.
+static void search_scan_ranges(lidx * index, const std::string & token, lidx_search_kind kind,
+    const search_stop_condition * stop, search_range_result * p_result)
 {
-  index->lidx_deleted->erase(key);
-  (* index->lidx_buffer)[key] = value;
-  index->lidx_buffer_dirty->insert(key);
-
-  return 0;
+  unsigned int threads_count = index->lidx_search_threads;
+  if (threads_count == 0) {
+    threads_count = lidx_thread_pool_size();
+  }
+  const lidx_storage_snapshot * snapshot = index->lidx_db->get_snapshot();
+  std::vector<std::pair<std::string, std::string> > ranges;
+  int parallel = search_split_ranges(index, threads_count, &ranges);
+  
+  std::vector<search_range_result> results(ranges.size());
+  std::vector<std::function<void ()> > tasks;
+  for(size_t i = 0 ; i < ranges.size() ; i ++) {
+    search_range_result * range_result = &results[i];
+    const std::pair<std::string, std::string> * range = &ranges[i];
+    range_result->keys_scanned = 0;
+    range_result->keys_matched = 0;
+    range_result->truncated = 0;
+    tasks.push_back([index, snapshot, range, &token, kind, stop, range_result]() {
+      search_scan_range(index, snapshot, range->first, range->second, token, kind, stop, range_result);
+    });
+  }
+  if (parallel) {
+    lidx_thread_pool_run(tasks);
+  }
+  else {
+    for(size_t i = 0 ; i < tasks.size() ; i ++) {
+      tasks[i]();
+    }
+  }
+  index->lidx_db->release_snapshot(snapshot);
+  
+  for(size_t i = 0 ; i < results.size() ; i ++) {
+    p_result->docsids.insert(p_result->docsids.end(), results[i].docsids.begin(), results[i].docsids.end());
+    p_result->keys_scanned += results[i].keys_scanned;
+    p_result->keys_matched += results[i].keys_matched;
+    if (results[i].truncated) {
+      p_result->truncated = 1;
+    }
+  }
+}
+
+// Keys that start with `prefix` followed by the byte `c`.
+// The first bucket also includes `prefix` itself, the last one ends at `limit`.
+static std::pair<std::string, std::string> search_bucket(const std::string & prefix, int c, const std::string & limit)
+{
+  std::string bucket_start = prefix;
+  if (c > 0) {
+    bucket_start.push_back((char) c);
+  }
+  std::string bucket_limit = limit;
+  if (c < 255) {
+    bucket_limit = prefix;
+    bucket_limit.push_back((char) (c + 1));
+  }
+  return std::pair<std::string, std::string>(bucket_start, bucket_limit);
+}
+
+// Splits the words keys in at most `count` ranges (plus the gaps of the
+// other keys) using the approximate size on disk of the keys
+// starting with each byte. The bytes that hold more than their share are
+// split again using the second byte.
+// Returns 1 if the ranges are worth scanning in parallel, 0 if they have to
+// be scanned on the calling thread.
+static int search_split_ranges(lidx * index, unsigned int count,
+    std::vector<std::pair<std::string, std::string> > * p_ranges)
+{
+  std::vector<std::pair<std::string, std::string> > buckets;
+  std::vector<int> buckets_bytes;
+  for(int c = 0 ; c < 256 ; c ++) {
+    if ((c == '\0') || (c == ',') || (c == '.') || (c == '/')) {
+      continue;
+    }
+    buckets.push_back(search_bucket(std::string(), c, std::string()));
+    buckets_bytes.push_back(c);
+  }
+  
+  std::vector<uint64_t> sizes;
+  uint64_t total_size = 0;
+  if (count > 1) {
+    index->lidx_db->get_approximate_sizes(buckets, &sizes);
+    for(size_t i = 0 ; i < sizes.size() ; i ++) {
+      total_size += sizes[i];
+    }
+  }
+  if (total_size < SEARCH_PARALLEL_MIN_SIZE) {
+    // Not worth running on several threads.
+    p_ranges->push_back(std::pair<std::string, std::string>(std::string("\1"), std::string(",")));
+    p_ranges->push_back(std::pair<std::string, std::string>(std::string("-"), std::string(".")));
+    p_ranges->push_back(std::pair<std::string, std::string>(std::string("0"), std::string()));
+    return 0;
+  }
+  
+  std::vector<std::pair<std::string, std::string> > refined_buckets;
+  std::vector<uint64_t> refined_sizes;
+  for(size_t i = 0 ; i < buckets.size() ; i ++) {
+    if (sizes[i] <= total_size / (count * 4)) {
+      refined_buckets.push_back(buckets[i]);
+      refined_sizes.push_back(sizes[i]);
+      continue;
+    }
+    std::vector<std::pair<std::string, std::string> > sub_buckets;
+    std::string prefix(1, (char) buckets_bytes[i]);
+    for(int c = 0 ; c < 256 ; c ++) {
+      sub_buckets.push_back(search_bucket(prefix, c, buckets[i].second));
+    }
+    sub_buckets[0].first = buckets[i].first;
+    std::vector<uint64_t> sub_sizes;
+    index->lidx_db->get_approximate_sizes(sub_buckets, &sub_sizes);
+    refined_buckets.insert(refined_buckets.end(), sub_buckets.begin(), sub_buckets.end());
+    refined_sizes.insert(refined_sizes.end(), sub_sizes.begin(), sub_sizes.end());
+  }
+  
+  // Groups consecutive buckets until they reach their share of the size.
+  uint64_t range_size = 0;
+  for(size_t i = 0 ; i < refined_buckets.size() ; i ++) {
+    if ((p_ranges->size() == 0) || (p_ranges->back().second != refined_buckets[i].first) ||
+      (range_size >= total_size / count)) {
+      p_ranges->push_back(refined_buckets[i]);
+      range_size = 0;
+    }
+    else {
+      p_ranges->back().second = refined_buckets[i].second;
+    }
+    range_size += refined_sizes[i];
+  }
+  return 1;
+}
+
+static void search_record_stats(uint64_t start, const search_range_result & range_result)
+{
+  lidx_stats_add(lidx_stats_counter_search_count, 1);
+  lidx_stats_add(lidx_stats_counter_search_keys_scanned, range_result.keys_scanned);
+  lidx_stats_add(lidx_stats_counter_search_keys_matched, range_result.keys_matched);
+  if (range_result.truncated) {
+    lidx_stats_add(lidx_stats_counter_search_truncated, 1);
+  }
+  lidx_stats_record(lidx_stats_histogram_search_keys_scanned_per_search, range_result.keys_scanned);
+  lidx_stats_record(lidx_stats_histogram_search_latency_us, (lidx_stats_now_ns() - start) / 1000);
+}
+
+static void search_copy_result(const std::vector<uint64_t> & docsids, uint64_t ** p_docsids, size_t * p_count)
+{
+  uint64_t * result = (uint64_t *) calloc(docsids.size(), sizeof(* result));
+  if (docsids.size() > 0) {
+    memcpy(result, &docsids[0], docsids.size() * sizeof(* result));
+  }
+  * p_docsids = result;
+  * p_count = docsids.size();
+}
+
+//int lidx_complete(lidx * index, const char * prefix, unsigned int max_count, ...);
+// prefix -> normalized prefix -> \0c[prefix] when the list knows enough words
+//                             -> scan of \0d[prefix] otherwise, the list is rebuilt
+
+static int complete_scan(lidx * index, const std::string & prefix, unsigned int max_count,
+    lidx_complete_list * p_result);
+
+int lidx_complete(lidx * index, const char * prefix, unsigned int max_count,
+    char *** p_words, uint64_t ** p_frequencies, size_t * p_count)
+{
+  int result;
+  UChar * uprefix = lidx_from_utf8(prefix);
+  result = lidx_u_complete(index, uprefix, max_count, p_words, p_frequencies, p_count);
+  free((void *) uprefix);
+  return result;
+}
+
+int lidx_u_complete(lidx * index, const UChar * uprefix, unsigned int max_count,
+    char *** p_words, uint64_t ** p_frequencies, size_t * p_count)
+{
+  int r = db_flush(index);
+  if (r < 0) {
+    return r;
+  }
+  
+  char * normalized = lidx_normalize(uprefix, -1, index->lidx_normalization_mode);
+  std::string prefix(normalized);
+  free(normalized);
+  
+  lidx_complete_list list;
+  lidx_complete_list_init(&list);
+  int has_list = 0;
+  if (lidx_complete_is_short_prefix(prefix) && (max_count <= LIDX_COMPLETE_LIST_SIZE)) {
+    std::string key;
+    std::string value;
+    lidx_complete_list_key(key, prefix);
+    r = db_get(index, key, &value);
+    if (r < -1) {
+      return -1;
+    }
+    if (r == 0) {
+      lidx_complete_list_decode(value, &list);
+    }
+    // When the floor is zero, the list has all the words of the prefix.
+    has_list = (lidx_complete_list_exact_count(list) >= max_count) || (list.floor == 0);
+  }
+  if (!has_list) {
+    r = complete_scan(index, prefix, max_count, &list);
+    if (r < 0) {
+      return r;
+    }
+  }
+  
+  size_t count = std::min((size_t) max_count, list.entries.size());
+  char ** words = (char **) calloc(count, sizeof(* words));
+  uint64_t * frequencies = (uint64_t *) calloc(count, sizeof(* frequencies));
+  for(size_t i = 0 ; i < count ; i ++) {
+    words[i] = strdup(list.entries[i].word.c_str());
+    frequencies[i] = list.entries[i].frequency;
+  }
+  * p_words = words;
+  if (p_frequencies != NULL) {
+    * p_frequencies = frequencies;
+  }
+  else {
+    free(frequencies);
+  }
+  * p_count = count;
+  
+  return 0;
+}
+
+void lidx_complete_free(char ** words, uint64_t * frequencies, size_t count)
+{
+  for(size_t i = 0 ; i < count ; i ++) {
+    free(words[i]);
+  }
+  free(words);
+  free(frequencies);
+}
+
+// Finds the most frequent words of the prefix using the frequencies of all
+// the words. The list of a short prefix is rebuilt at the same time.
+static int complete_scan(lidx * index, const std::string & prefix, unsigned int max_count,
+    lidx_complete_list * p_result)
+{
+  int is_short_prefix = lidx_complete_is_short_prefix(prefix);
+  lidx_complete_list list;
+  lidx_complete_list_init(&list);
+  lidx_complete_list_init(p_result);
+  
+  std::string start;
+  lidx_complete_frequency_key(start, prefix);
+  lidx_storage_iterator * iterator = index->lidx_db->new_iterator(NULL);
+  for(iterator->seek(start) ; iterator->is_valid() && iterator->key().starts_with(start) ; iterator->next()) {
+    std::string word = iterator->key().ToString().substr(start.size() - prefix.size());
+    std::string value = iterator->value().ToString();
+    uint64_t frequency;
+    lidx_decode_uint64(value, 0, &frequency);
+    lidx_complete_list_update(p_result, word, frequency, max_count);
+    if (is_short_prefix) {
+      lidx_complete_list_update(&list, word, frequency, LIDX_COMPLETE_LIST_SIZE);
+    }
+  }
+  int result = iterator->status();
+  delete iterator;
+  if (result < 0) {
+    return result;
+  }
+  
+  if (is_short_prefix) {
+    std::string key;
+    std::string value;
+    lidx_complete_list_key(key, prefix);
+    lidx_complete_list_encode(value, list);
+    return db_put(index, key, value);
+  }
+  return 0;
+}
+
+//int lidx_vacuum(lidx * index);
+// \0v -> [first new word id], [count], [words ids that are kept, delta encoded]
+// word -> remove tombstones from [docs ids], or remove the word if empty
+// words ids are renumbered in the same order from the first new word id.
+// ,[docid] -> remove if tombstone, else renumber [words ids]
+// /[word id] -> remove unless it's a new word id
+// \0d[word] -> number of remaining docs ids, written with the word
+// \0c[prefix] -> rebuilt from the remaining words in the last write
+// \0t[chunk], \0v -> removed in a single write once all the keys are rewritten
+//
+// The new words ids don't overlap the ones in use, so the keys that were
+// already rewritten are recognized and an interrupted vacuum resumes from
+// \0v. The new ids start at 0 when there's enough room below the ids in
+// use, after the last word id otherwise.
+
+struct vacuum_marker {
+  uint64_t first_wordid;
+  // Sorted words ids that are kept.
+  std::vector<uint64_t> wordsids;
+};
+
+static int vacuum_start(lidx * index);
+static int vacuum_resume(lidx * index);
+static int vacuum_is_new_wordid(const vacuum_marker & marker, uint64_t wordid);
+static int vacuum_new_wordid(const vacuum_marker & marker, uint64_t wordid, uint64_t * p_new_wordid);
+static int vacuum_filter_docsids(lidx * index, std::string & value_str, std::string * p_filtered);
+static int vacuum_write_batch(lidx * index, lidx_storage_batch * batch, int force);
+
+int lidx_vacuum(lidx * index)
+{
+  int r = db_flush(index);
+  if (r < 0) {
+    return r;
+  }
+  
+  if (!index->lidx_vacuum_pending) {
+    r = vacuum_start(index);
+  }
+  if (r == 0) {
+    r = vacuum_resume(index);
+  }
+  
+  // The values read before the vacuum are stale.
+  index->lidx_buffer->clear();
+  index->lidx_tombstones->clear();
+  if (index->lidx_cache != NULL) {
+    lidx_query_cache_invalidate_all(index->lidx_cache);
+  }
+  if (r < 0) {
+    // The tombstones are removed by the last write.
+    load_tombstones(index);
+    return -1;
+  }
+  return 0;
+}
+
+// Chooses the new words ids and writes \0v.
+static int vacuum_start(lidx * index)
+{
+  uint64_t next_wordid = 0;
+  std::string nextwordidkey(".");
+  std::string value;
+  int r = index->lidx_db->get(nextwordidkey, &value);
+  if (r < -1) {
+    return -1;
+  }
+  if (r == 0) {
+    lidx_decode_uint64(value, 0, &next_wordid);
+  }
+  
+  // Collects the words ids that are still in use.
+  vacuum_marker marker;
+  uint64_t min_wordid = next_wordid;
+  lidx_storage_iterator * iterator = index->lidx_db->new_iterator(NULL);
+  for(iterator->seek_to_first() ; iterator->is_valid() ; iterator->next()) {
+    if (!lidx_is_word_key(iterator->key())) {
+      continue;
+    }
+    std::string value_str = iterator->value().ToString();
+    uint64_t wordid;
+    std::string filtered;
+    lidx_decode_uint64(value_str, 0, &wordid);
+    min_wordid = std::min(min_wordid, wordid);
+    if (vacuum_filter_docsids(index, value_str, &filtered)) {
+      marker.wordsids.push_back(wordid);
+    }
+  }
+  r = iterator->status();
+  delete iterator;
+  if (r < 0) {
+    return -1;
+  }
+  std::sort(marker.wordsids.begin(), marker.wordsids.end());
+  marker.first_wordid = (marker.wordsids.size() <= min_wordid) ? 0 : next_wordid;
+  
+  std::string key;
+  lidx_metadata_key(key, LIDX_METADATA_VACUUM);
+  value.clear();
+  lidx_encode_uint64(value, marker.first_wordid);
+  lidx_encode_uint64(value, marker.wordsids.size());
+  uint64_t previous_wordid = 0;
+  for(size_t i = 0 ; i < marker.wordsids.size() ; i ++) {
+    lidx_encode_uint64(value, marker.wordsids[i] - previous_wordid);
+    previous_wordid = marker.wordsids[i];
+  }
+  lidx_storage_batch batch;
+  lidx_storage_batch_init(&batch);
+  lidx_storage_batch_put(&batch, key, value);
+  // New words can't be given the new ids.
+  value.clear();
+  lidx_encode_uint64(value, std::max(next_wordid, marker.first_wordid + marker.wordsids.size()));
+  lidx_storage_batch_put(&batch, nextwordidkey, value);
+  if (index->lidx_db->write(&batch) < 0) {
+    return -1;
+  }
+  index->lidx_vacuum_pending = 1;
+  return 0;
+}
+
+// Rewrites the keys as described by \0v. Keys that were already rewritten
+// are left unchanged.
+static int vacuum_resume(lidx * index)
+{
+  std::string marker_key;
+  std::string value;
+  lidx_metadata_key(marker_key, LIDX_METADATA_VACUUM);
+  int r = index->lidx_db->get(marker_key, &value);
+  if (r < 0) {
+    return -1;
+  }
+  vacuum_marker marker;
+  uint64_t count;
+  size_t position = lidx_decode_uint64(value, 0, &marker.first_wordid);
+  position = lidx_decode_uint64(value, position, &count);
+  uint64_t wordid = 0;
+  while (position < value.size()) {
+    uint64_t delta;
+    position = lidx_decode_uint64(value, position, &delta);
+    wordid += delta;
+    marker.wordsids.push_back(wordid);
+  }
+  if ((position > value.size()) || (marker.wordsids.size() != count)) {
+    return -1;
+  }
+  
+  const lidx_storage_snapshot * snapshot = index->lidx_db->get_snapshot();
+  lidx_storage_batch batch;
+  lidx_storage_batch_init(&batch);
+  int result = 0;
+  std::string lists_prefix;
+  lidx_metadata_key(lists_prefix, LIDX_METADATA_COMPLETION);
+  std::vector<std::string> lists_keys;
+  lidx_complete_builder builder;
+  lidx_storage_iterator * iterator = index->lidx_db->new_iterator(snapshot);
+  for(iterator->seek_to_first() ; iterator->is_valid() ; iterator->next()) {
+    std::string key = iterator->key().ToString();
+    std::string value_str = iterator->value().ToString();
+    
+    if (iterator->key().starts_with(lists_prefix)) {
+      lists_keys.push_back(key);
+    }
+    else if (key[0] == ',') {
+      uint64_t doc;
+      lidx_decode_uint64(key, 1, &doc);
+      if (is_tombstone(index, doc)) {
+        lidx_storage_batch_delete(&batch, key);
+      }
+      else {
+        std::string value;
+        size_t position = 0;
+        while (position < value_str.size()) {
+          uint64_t wordid;
+          uint64_t new_wordid;
+          position = lidx_decode_uint64(value_str, position, &wordid);
+          if (vacuum_new_wordid(marker, wordid, &new_wordid) == 0) {
+            lidx_encode_uint64(value, new_wordid);
+          }
+        }
+        if (value != value_str) {
+          lidx_storage_batch_put(&batch, key, value);
+        }
+      }
+    }
+    else if (key[0] == '/') {
+      // Entries of the new ids are written with the words.
+      uint64_t wordid;
+      lidx_decode_uint64(key, 1, &wordid);
+      if (!vacuum_is_new_wordid(marker, wordid)) {
+        lidx_storage_batch_delete(&batch, key);
+      }
+    }
+    else if (lidx_is_word_key(key)) {
+      uint64_t wordid;
+      uint64_t new_wordid;
+      std::string filtered;
+      std::string word = lidx_key_word(key).ToString();
+      std::string frequency_key;
+      size_t docsids_position = lidx_decode_uint64(value_str, 0, &wordid);
+      uint64_t frequency = vacuum_filter_docsids(index, value_str, &filtered);
+      lidx_complete_frequency_key(frequency_key, word);
+      if (frequency == 0) {
+        lidx_storage_batch_delete(&batch, key);
+        lidx_storage_batch_delete(&batch, frequency_key);
+      }
+      else if (!vacuum_is_new_wordid(marker, wordid)) {
+        if (vacuum_new_wordid(marker, wordid, &new_wordid) < 0) {
+          // The word was added after the vacuum started.
+          result = -1;
+          break;
+        }
+        std::string value;
+        lidx_encode_uint64(value, new_wordid);
+        value.append(filtered);
+        lidx_storage_batch_put(&batch, key, value);
+        std::string wordidkey("/");
+        lidx_encode_uint64(wordidkey, new_wordid);
+        lidx_storage_batch_put(&batch, wordidkey, word);
+        if (filtered.size() != value_str.size() - docsids_position) {
+          // The frequency counted the removed documents.
+          std::string frequency_value;
+          lidx_encode_uint64(frequency_value, frequency);
+          lidx_storage_batch_put(&batch, frequency_key, frequency_value);
+        }
+      }
+      if (frequency > 0) {
+        lidx_complete_builder_add(&builder, word, frequency);
+      }
+    }
+    
+    r = vacuum_write_batch(index, &batch, 0);
+    if (r < 0) {
+      result = r;
+      break;
+    }
+  }
+  if (iterator->status() < 0) {
+    result = -1;
+  }
+  delete iterator;
+  index->lidx_db->release_snapshot(snapshot);
+  if (result < 0) {
+    return result;
+  }
+  r = vacuum_write_batch(index, &batch, 1);
+  if (r < 0) {
+    return r;
+  }
+  
+  // The list of the empty prefix is always written.
+  lidx_complete_list empty_list;
+  lidx_complete_list_init(&empty_list);
+  builder.lists.insert(std::pair<std::string, lidx_complete_list>(std::string(), empty_list));
+  for(size_t i = 0 ; i < lists_keys.size() ; i ++) {
+    if (builder.lists.find(lists_keys[i].substr(lists_prefix.size())) == builder.lists.end()) {
+      lidx_storage_batch_delete(&batch, lists_keys[i]);
+    }
+  }
+  for(std::map<std::string, lidx_complete_list>::iterator lists_iterator = builder.lists.begin() ; lists_iterator != builder.lists.end() ; ++ lists_iterator) {
+    std::string key;
+    std::string list_value;
+    lidx_complete_list_key(key, lists_iterator->first);
+    lidx_complete_list_encode(list_value, lists_iterator->second);
+    lidx_storage_batch_put(&batch, key, list_value);
+  }
+  for(std::map<uint64_t, std::string>::iterator tombstones_iterator = index->lidx_tombstones->begin() ; tombstones_iterator != index->lidx_tombstones->end() ; ++ tombstones_iterator) {
+    std::string key;
+    tombstones_key(key, tombstones_iterator->first);
+    lidx_storage_batch_delete(&batch, key);
+  }
+  lidx_storage_batch_delete(&batch, marker_key);
+  std::string nextwordidkey(".");
+  value.clear();
+  lidx_encode_uint64(value, marker.first_wordid + marker.wordsids.size());
+  lidx_storage_batch_put(&batch, nextwordidkey, value);
+  if (index->lidx_db->write(&batch) < 0) {
+    return -1;
+  }
+  index->lidx_vacuum_pending = 0;
+  return 0;
+}
+
+static int vacuum_is_new_wordid(const vacuum_marker & marker, uint64_t wordid)
+{
+  return (wordid >= marker.first_wordid) && (wordid < marker.first_wordid + marker.wordsids.size());
+}
+
+// Stores the word id that replaces `wordid` in `* p_new_wordid`.
+// Returns -1 if the word is removed.
+static int vacuum_new_wordid(const vacuum_marker & marker, uint64_t wordid, uint64_t * p_new_wordid)
+{
+  if (vacuum_is_new_wordid(marker, wordid)) {
+    // Already rewritten.
+    * p_new_wordid = wordid;
+    return 0;
+  }
+  std::vector<uint64_t>::const_iterator wordsids_iterator = std::lower_bound(marker.wordsids.begin(), marker.wordsids.end(), wordid);
+  if ((wordsids_iterator == marker.wordsids.end()) || (* wordsids_iterator != wordid)) {
+    return -1;
+  }
+  * p_new_wordid = marker.first_wordid + (wordsids_iterator - marker.wordsids.begin());
+  return 0;
+}
+
+// Stores the docs ids of a word entry without the tombstones in `* p_filtered`.
+// Returns the number of remaining docs ids.
+static int vacuum_filter_docsids(lidx * index, std::string & value_str, std::string * p_filtered)
+{
+  int count = 0;
+  uint64_t wordid;
+  size_t position = lidx_decode_uint64(value_str, 0, &wordid);
+  while (position < value_str.size()) {
+    uint64_t docid;
+    position = lidx_decode_uint64(value_str, position, &docid);
+    if (is_tombstone(index, docid)) {
+      continue;
+    }
+    lidx_encode_uint64(* p_filtered, docid);
+    count ++;
+  }
+  return count;
+}
+
+static int vacuum_write_batch(lidx * index, lidx_storage_batch * batch, int force)
+{
+  if (!force && (batch->size < 4 * 1024 * 1024)) {
+    return 0;
+  }
+  if (index->lidx_db->write(batch) < 0) {
+    return -1;
+  }
+  lidx_storage_batch_init(batch);
+  return 0;
+}
+
+// Dump and restore.
+
+static int restore_clear(lidx * index);
+
+int lidx_dump(lidx * index, int fd)
+{
+  if (db_flush(index) < 0) {
+    return -1;
+  }
+  const lidx_storage_snapshot * snapshot = index->lidx_db->get_snapshot();
+  lidx_storage_iterator * iterator = index->lidx_db->new_iterator(snapshot);
+  int result = lidx_dump_write(iterator, fd);
+  delete iterator;
+  index->lidx_db->release_snapshot(snapshot);
+  return result;
+}
+
+int lidx_restore(lidx * index, int fd)
+{
+  if (db_flush(index) < 0) {
+    return -1;
+  }
+  // The normalization is replaced by the one of the dump and checked once
+  // it's restored.
+  std::string normalization_key;
+  lidx_metadata_key(normalization_key, LIDX_METADATA_NORMALIZATION);
+  lidx_storage_iterator * iterator = index->lidx_db->new_iterator(NULL);
+  iterator->seek_to_first();
+  if (iterator->is_valid() && (iterator->key().compare(normalization_key) == 0)) {
+    iterator->next();
+  }
+  int empty = !iterator->is_valid();
+  delete iterator;
+  if (!empty) {
+    return -1;
+  }
+
+  int result = lidx_dump_read(fd, index->lidx_db);
+  if (index->lidx_cache != NULL) {
+    lidx_query_cache_invalidate_all(index->lidx_cache);
+  }
+  index->lidx_tombstones->clear();
+  if (result == 0) {
+    result = load_storage(index);
+  }
+  if (result < 0) {
+    // The keys read before the error are removed.
+    restore_clear(index);
+    return -1;
+  }
+  return 0;
+}
+
+// Removes all the keys of the index, except the normalization.
+static int restore_clear(lidx * index)
+{
+  buffer_gauges_clear(index);
+  index->lidx_buffer->clear();
+  index->lidx_buffer_dirty->clear();
+  index->lidx_deleted->clear();
+  index->lidx_frequency_deltas->clear();
+  index->lidx_tombstones->clear();
+  index->lidx_vacuum_pending = 0;
+  
+  lidx_storage_batch batch;
+  lidx_storage_batch_init(&batch);
+  int result = 0;
+  lidx_storage_iterator * iterator = index->lidx_db->new_iterator(NULL);
+  for(iterator->seek_to_first() ; iterator->is_valid() ; iterator->next()) {
+    lidx_storage_batch_delete(&batch, iterator->key().ToString());
+    if (vacuum_write_batch(index, &batch, 0) < 0) {
+      result = -1;
+      break;
+    }
+  }
+  if (iterator->status() < 0) {
+    result = -1;
+  }
+  delete iterator;
+  if (result < 0) {
+    return result;
+  }
+  if (vacuum_write_batch(index, &batch, 1) < 0) {
+    return -1;
+  }
+  return check_normalization(index);
+}
+
+// Completion.
+
+// Builds the frequencies and the completion lists of an index created
+// before they existed.
+static int build_completion(lidx * index)
+{
+  std::string value;
+  int r = index->lidx_db->get(".", &value);
+  if (r == -1) {
+    // Empty index.
+    return 0;
+  }
+  if (r < 0) {
+    return -1;
+  }
+  std::string list_key;
+  lidx_complete_list_key(list_key, std::string());
+  r = index->lidx_db->get(list_key, &value);
+  if (r == 0) {
+    return 0;
+  }
+  if (r != -1) {
+    return -1;
+  }
+  
+  lidx_complete_builder builder;
+  lidx_storage_batch batch;
+  lidx_storage_batch_init(&batch);
+  int result = 0;
+  lidx_storage_iterator * iterator = index->lidx_db->new_iterator(NULL);
+  for(iterator->seek_to_first() ; iterator->is_valid() ; iterator->next()) {
+    if (!lidx_is_word_key(iterator->key())) {
+      continue;
+    }
+    // The removed documents are counted until they're vacuumed.
+    std::string value_str = iterator->value().ToString();
+    uint64_t frequency = 0;
+    uint64_t number;
+    size_t position = lidx_decode_uint64(value_str, 0, &number);
+    while (position < value_str.size()) {
+      position = lidx_decode_uint64(value_str, position, &number);
+      frequency ++;
+    }
+    if (frequency == 0) {
+      continue;
+    }
+    std::string word = lidx_key_word(iterator->key()).ToString();
+    lidx_complete_builder_add(&builder, word, frequency);
+    std::string key;
+    lidx_complete_frequency_key(key, word);
+    std::string frequency_value;
+    lidx_encode_uint64(frequency_value, frequency);
+    lidx_storage_batch_put(&batch, key, frequency_value);
+    if (vacuum_write_batch(index, &batch, 0) < 0) {
+      result = -1;
+      break;
+    }
+  }
+  delete iterator;
+  if (result < 0) {
+    return result;
+  }
+  
+  // The list of the empty prefix is always written.
+  lidx_complete_list empty_list;
+  lidx_complete_list_init(&empty_list);
+  builder.lists.insert(std::pair<std::string, lidx_complete_list>(std::string(), empty_list));
+  for(std::map<std::string, lidx_complete_list>::iterator lists_iterator = builder.lists.begin() ; lists_iterator != builder.lists.end() ; ++ lists_iterator) {
+    std::string key;
+    std::string list_value;
+    lidx_complete_list_key(key, lists_iterator->first);
+    lidx_complete_list_encode(list_value, lists_iterator->second);
+    lidx_storage_batch_put(&batch, key, list_value);
+    if (vacuum_write_batch(index, &batch, 0) < 0) {
+      return -1;
+    }
+  }
+  return vacuum_write_batch(index, &batch, 1);
+}
+
+// Changes the number of documents that contain `word`.
+// The frequencies and the completion lists are updated by `db_flush()`.
+static void add_word_frequency(lidx * index, const std::string & word, int64_t delta)
+{
+  (* index->lidx_frequency_deltas)[word] += delta;
+}
+
+// Writes the changed frequencies and updates the completion lists of their
+// prefixes. Each list is read and written once.
+static int update_completion(lidx * index)
+{
+  if (index->lidx_frequency_deltas->size() == 0) {
+    return 0;
+  }
+  
+  std::map<std::string, lidx_complete_list> lists;
+  for(std::map<std::string, int64_t>::iterator deltas_iterator = index->lidx_frequency_deltas->begin() ; deltas_iterator != index->lidx_frequency_deltas->end() ; ++ deltas_iterator) {
+    const std::string & word = deltas_iterator->first;
+    int64_t delta = deltas_iterator->second;
+    if (delta == 0) {
+      continue;
+    }
+    
+    std::string key;
+    std::string value;
+    uint64_t frequency = 0;
+    lidx_complete_frequency_key(key, word);
+    int r = db_get(index, key, &value);
+    if (r < -1) {
+      return -1;
+    }
+    if (r == 0) {
+      lidx_decode_uint64(value, 0, &frequency);
+    }
+    if ((delta < 0) && (frequency < (uint64_t) -delta)) {
+      frequency = 0;
+    }
+    else {
+      frequency += delta;
+    }
+    if (frequency == 0) {
+      r = db_delete(index, key);
+    }
+    else {
+      value.clear();
+      lidx_encode_uint64(value, frequency);
+      r = db_put(index, key, value);
+    }
+    if (r < 0) {
+      return r;
+    }
+    
+    std::vector<std::string> prefixes;
+    lidx_complete_short_prefixes(word, &prefixes);
+    for(size_t i = 0 ; i < prefixes.size() ; i ++) {
+      std::map<std::string, lidx_complete_list>::iterator lists_iterator = lists.find(prefixes[i]);
+      if (lists_iterator == lists.end()) {
+        lidx_complete_list list;
+        lidx_complete_list_init(&list);
+        lidx_complete_list_key(key, prefixes[i]);
+        r = db_get(index, key, &value);
+        if (r < -1) {
+          return -1;
+        }
+        if (r == 0) {
+          lidx_complete_list_decode(value, &list);
+        }
+        lists_iterator = lists.insert(std::pair<std::string, lidx_complete_list>(prefixes[i], list)).first;
+      }
+      lidx_complete_list_update(&lists_iterator->second, word, frequency, LIDX_COMPLETE_LIST_SIZE);
+    }
+  }
+  
+  for(std::map<std::string, lidx_complete_list>::iterator lists_iterator = lists.begin() ; lists_iterator != lists.end() ; ++ lists_iterator) {
+    std::string key;
+    std::string value;
+    lidx_complete_list_key(key, lists_iterator->first);
+    lidx_complete_list_encode(value, lists_iterator->second);
+    int r = db_put(index, key, value);
+    if (r < 0) {
+      return r;
+    }
+  }
+  index->lidx_frequency_deltas->clear();
+  return 0;
+}
+
+// Tombstones.
+
+static void tombstones_key(std::string & key, uint64_t chunk)
+{
+  lidx_metadata_key(key, LIDX_METADATA_TOMBSTONES);
+  lidx_encode_uint64(key, chunk);
+}
+
+// Returns -1 if a bitmap is corrupted.
+static int load_tombstones(lidx * index)
+{
+  std::string prefix;
+  lidx_metadata_key(prefix, LIDX_METADATA_TOMBSTONES);
+  int result = 0;
+  lidx_storage_iterator * iterator = index->lidx_db->new_iterator(NULL);
+  for(iterator->seek(prefix) ; iterator->is_valid() && iterator->key().starts_with(prefix) ; iterator->next()) {
+    std::string key = iterator->key().ToString();
+    if ((key.size() == prefix.size()) || (iterator->value().size() != TOMBSTONES_CHUNK_SIZE)) {
+      result = -1;
+      break;
+    }
+    uint64_t chunk;
+    lidx_decode_uint64(key, prefix.size(), &chunk);
+    (* index->lidx_tombstones)[chunk] = iterator->value().ToString();
+  }
+  if (iterator->status() < 0) {
+    result = -1;
+  }
+  delete iterator;
+  if (result < 0) {
+    index->lidx_tombstones->clear();
+  }
+  return result;
+}
+
+static int is_tombstone(lidx * index, uint64_t doc)
+{
+  if (index->lidx_tombstones->size() == 0) {
+    return 0;
+  }
+  std::map<uint64_t, std::string>::iterator chunk_iterator = index->lidx_tombstones->find(doc >> TOMBSTONES_CHUNK_BITS);
+  if (chunk_iterator == index->lidx_tombstones->end()) {
+    return 0;
+  }
+  unsigned int bit = doc & ((1 << TOMBSTONES_CHUNK_BITS) - 1);
+  return (chunk_iterator->second[bit / 8] >> (bit % 8)) & 1;
+}
+
+static int set_tombstone(lidx * index, uint64_t doc, int removed)
+{
+  uint64_t chunk = doc >> TOMBSTONES_CHUNK_BITS;
+  unsigned int bit = doc & ((1 << TOMBSTONES_CHUNK_BITS) - 1);
+  std::string & bitmap = (* index->lidx_tombstones)[chunk];
+  if (bitmap.size() == 0) {
+    bitmap.resize(TOMBSTONES_CHUNK_SIZE, 0);
+  }
+  if (removed) {
+    bitmap[bit / 8] |= (1 << (bit % 8));
+  }
+  else {
+    bitmap[bit / 8] &= ~(1 << (bit % 8));
+  }
+  
+  std::string key;
+  tombstones_key(key, chunk);
+  if (bitmap.find_first_not_of('\0') == std::string::npos) {
+    index->lidx_tombstones->erase(chunk);
+    return db_delete(index, key);
+  }
+  return db_put(index, key, bitmap);
+}
+
+static int db_put(lidx * index, std::string & key, std::string & value)
+{
+  if (index->lidx_deleted->erase(key) > 0) {
+    buffer_gauges_add(index, 0, value.size());
+  }
+  else if (index->lidx_buffer_dirty->find(key) != index->lidx_buffer_dirty->end()) {
+    buffer_gauges_add(index, 0, (int64_t) value.size() - (int64_t) (* index->lidx_buffer)[key].size());
+  }
+  else {
+    buffer_gauges_add(index, 1, key.size() + value.size());
+  }
+  (* index->lidx_buffer)[key] = value;
+  index->lidx_buffer_dirty->insert(key);
+
+  return 0;
 }
 
 static int db_get(lidx * index, std::string & key, std::string * p_value)
 {
   if (index->lidx_deleted->find(key) != index->lidx_deleted->end()) {
+    lidx_stats_add(lidx_stats_counter_get_buffer_hits, 1);
     return -1;
   }
 
   if (index->lidx_buffer->find(key) != index->lidx_buffer->end()) {
+    lidx_stats_add(lidx_stats_counter_get_buffer_hits, 1);
     * p_value = (* index->lidx_buffer)[key];
     return 0;
   }
   
-  leveldb::ReadOptions read_options;
-  leveldb::Status status = index->lidx_db->Get(read_options, key, p_value);
-  if (status.IsNotFound()) {
-    return -1;
-  }
-  if (!status.ok()) {
-    return -2;
+  lidx_stats_add(lidx_stats_counter_get_buffer_misses, 1);
+  int r = index->lidx_db->get(key, p_value);
+  if (r < 0) {
+    return r;
   }
   (* index->lidx_buffer)[key] = * p_value;
   return 0;
@@ -512,6 +1943,12 @@ static int db_get(lidx * index, std::string & key, std::string * p_value)
 
 static int db_delete(lidx * index, std::string & key)
 {
+  if (index->lidx_buffer_dirty->find(key) != index->lidx_buffer_dirty->end()) {
+    buffer_gauges_add(index, 0, - (int64_t) (* index->lidx_buffer)[key].size());
+  }
+  else if (index->lidx_deleted->find(key) == index->lidx_deleted->end()) {
+    buffer_gauges_add(index, 1, key.size());
+  }
   index->lidx_deleted->insert(key);
   index->lidx_buffer_dirty->erase(key);
   index->lidx_buffer->erase(key);
@@ -520,26 +1957,70 @@ static int db_delete(lidx * index, std::string & key)
 
 static int db_flush(lidx * index)
 {
+  if (update_completion(index) < 0) {
+    return -1;
+  }
   if ((index->lidx_buffer_dirty->size() == 0) && (index->lidx_deleted->size() == 0)) {
     return 0;
   }
-  leveldb::WriteBatch batch;
+  uint64_t start = lidx_stats_now_ns();
+  lidx_storage_batch batch;
+  lidx_storage_batch_init(&batch);
   for(std::set<std::string>::iterator set_iterator = index->lidx_buffer_dirty->begin() ; set_iterator != index->lidx_buffer_dirty->end() ; ++ set_iterator) {
-    std::string key = * set_iterator;
-    std::string value = (* index->lidx_buffer)[key];
-    batch.Put(key, value);
+    lidx_storage_batch_put(&batch, * set_iterator, (* index->lidx_buffer)[* set_iterator]);
   }
   for(std::set<std::string>::iterator set_iterator = index->lidx_deleted->begin() ; set_iterator != index->lidx_deleted->end() ; ++ set_iterator) {
-    std::string key = * set_iterator;
-    batch.Delete(key);
+    lidx_storage_batch_delete(&batch, * set_iterator);
   }
-  leveldb::WriteOptions write_options;
-  leveldb::Status status = index->lidx_db->Write(write_options, &batch);
-  if (!status.ok()) {
+  if (index->lidx_db->write(&batch) < 0) {
     return -1;
   }
+  lidx_stats_add(lidx_stats_counter_flush_count, 1);
+  lidx_stats_add(lidx_stats_counter_flush_keys, index->lidx_buffer_dirty->size() + index->lidx_deleted->size());
+  lidx_stats_add(lidx_stats_counter_flush_bytes, batch.size);
+  lidx_stats_record(lidx_stats_histogram_flush_latency_us, (lidx_stats_now_ns() - start) / 1000);
+  if (index->lidx_cache != NULL) {
+    invalidate_query_cache(index);
+  }
+  buffer_gauges_clear(index);
   index->lidx_buffer->clear();
   index->lidx_buffer_dirty->clear();
   index->lidx_deleted->clear();
   return 0;
-}
\ No newline at end of file
+}
+
+// Changes the number of keys and the size of the write buffer, see `lidx_stats`.
+static void buffer_gauges_add(lidx * index, int64_t keys, int64_t bytes)
+{
+  index->lidx_buffer_bytes += bytes;
+  lidx_stats_gauge_add(lidx_stats_gauge_buffer_keys, keys);
+  lidx_stats_gauge_add(lidx_stats_gauge_buffer_bytes, bytes);
+}
+
+// Called when the keys waiting to be flushed are dropped.
+static void buffer_gauges_clear(lidx * index)
+{
+  buffer_gauges_add(index, - (int64_t) (index->lidx_buffer_dirty->size() + index->lidx_deleted->size()), - index->lidx_buffer_bytes);
+}
+
+// Drops the cached results that are changed by the keys written by `db_flush()`.
+static void invalidate_query_cache(lidx * index)
+{
+  for(std::set<std::string>::iterator set_iterator = index->lidx_buffer_dirty->begin() ; set_iterator != index->lidx_buffer_dirty->end() ; ++ set_iterator) {
+    invalidate_query_cache_key(index, * set_iterator);
+  }
+  for(std::set<std::string>::iterator set_iterator = index->lidx_deleted->begin() ; set_iterator != index->lidx_deleted->end() ; ++ set_iterator) {
+    invalidate_query_cache_key(index, * set_iterator);
+  }
+}
+
+static void invalidate_query_cache_key(lidx * index, const std::string & key)
+{
+  if (lidx_is_word_key(key)) {
+    lidx_query_cache_invalidate_word(index->lidx_cache, lidx_key_word(key).ToString());
+  }
+  else if ((key.size() > 1) && (key[0] == '\0') && (key[1] == LIDX_METADATA_TOMBSTONES)) {
+    // Any result might contain a removed document.
+    lidx_query_cache_invalidate_all(index->lidx_cache);
+  }
+}
@@ -26,6 +26,13 @@ typedef enum lidx_search_kind {
   lidx_search_kind_suffix, // Search documents that has strings that end the given token.
 } lidx_search_kind;
 
+// How the words are normalized before being stored in the index and how the
+// searched tokens are normalized.
+typedef enum lidx_normalization {
+  lidx_normalization_transliterate, // Words are transliterated to latin, lowercased and diacritics are removed (default).
+  lidx_normalization_lowercase, // Words are lowercased only. It's faster and it keeps the original script.
+} lidx_normalization;
+
 // Create a new indexer.
 lidx * lidx_new(void);
 
@@ -35,9 +42,25 @@ void lidx_free(lidx * index);
 // Open the indexer.
 int lidx_open(lidx * index, const char * filename);
 
+// Opens an empty indexer stored in memory.
+// Nothing is written to disk and the content is lost when the indexer is closed.
+int lidx_open_memory(lidx * index);
+
 // Close the indexer.
 void lidx_close(lidx * index);
 
+// Sets the normalization of the words. See `lidx_normalization`.
+// It's stored in the index when it's created. Opening an index that uses
+// another normalization fails.
+void lidx_set_normalization(lidx * index, lidx_normalization normalization);
+
+// Enables the cache of the results of the searches.
+// `max_size`: approximate memory used by the cache in bytes. Zero disables the cache.
+// A cached result is dropped when a document that changes the words it
+// matches is written to the index, and all the results are dropped when a
+// document is removed.
+void lidx_set_query_cache_size(lidx * index, size_t max_size);
+
 // Adds a UTF-8 document to the indexer.
 // `doc`: document identifier (numerical identifier in a 64-bits range)
 // `content`: content of the document in UTF-8 encoding.
@@ -57,8 +80,31 @@ int lidx_set2(lidx * index, uint64_t doc, const char * text, int tokenize_enable
 int lidx_u_set2(lidx * index, uint64_t doc, const UChar * utext, int tokenize_enabled);
 
 // Removes a document from the indexer.
+// The document is marked as removed and won't be returned by searches.
+// The space is reclaimed by `lidx_vacuum()`. Until then, the document still
+// counts in the frequencies returned by `lidx_complete()`.
 int lidx_remove(lidx * index, uint64_t doc);
 
+// Purges the removed documents from the index, removes the words that are
+// not used any more and renumbers the words ids.
+// This operation rewrites the whole index. When it's interrupted, it's
+// finished by the next call to `lidx_vacuum()`, `lidx_set()`, `lidx_remove()`
+// or when the index is opened again.
+int lidx_vacuum(lidx * index);
+
+// Writes a snapshot of the whole index to the file descriptor `fd` as a
+// compact binary stream, with the keys in sorted order and checksums.
+// The stream can be loaded by `lidx_restore()` to create a copy of the index
+// without indexing the documents again.
+int lidx_dump(lidx * index, int fd);
+
+// Loads a stream written by `lidx_dump()` from the file descriptor `fd`.
+// The index must be open and empty. It fails if the dumped index used another
+// normalization.
+// Returns -1 if the stream is truncated or corrupted, in which case the keys
+// that were already written are removed and the index is left empty.
+int lidx_restore(lidx * index, int fd);
+
 // Searches a UTF-8 token in the indexer.
 // `token`: string to search in UTF-8 encoding.
 // `kind`: kind of matching to perform. See `lidx_search_kind`.
@@ -69,14 +115,198 @@ int lidx_remove(lidx * index, uint64_t doc);
 int lidx_search(lidx * index, const char * token, lidx_search_kind kind,
     uint64_t ** p_docsids, size_t * p_count);
 
+// Sets the number of threads used by the substring and suffix searches.
+// Zero uses one thread per core, which is the default.
+// The searches on small indexes run on a single thread.
+void lidx_set_search_threads(lidx * index, unsigned int count);
+
 // Searches a unicode token in the indexer.
 // `token`: string to search in UTF-16 encoding.
 int lidx_u_search(lidx * index, const UChar * utoken, lidx_search_kind kind,
     uint64_t ** p_docsids, size_t * p_count);
 
+// Asynchronous searches.
+// The scan runs on its own thread. It stops when its deadline is reached or
+// when it's cancelled, and the documents found so far are returned as a
+// truncated result.
+// The index must not be modified or closed until the search is finished.
+
+typedef struct lidx_search_handle lidx_search_handle;
+
+// Called on the thread of the search when the result is available, or before
+// `lidx_search_start()` returns when the result is in the query cache.
+// `lidx_search_finish()` must not be called from the callback.
+typedef void (* lidx_search_callback)(lidx_search_handle * search, void * context);
+
+// Starts searching a UTF-8 token in the indexer.
+// `timeout_ms`: maximum duration of the search in milliseconds. Zero disables the deadline.
+// `callback`: called when the result is available. It can be NULL.
+// `context`: passed to the callback.
+//
+// The search has to be finished using `lidx_search_finish()`.
+lidx_search_handle * lidx_search_start(lidx * index, const char * token, lidx_search_kind kind,
+    unsigned int timeout_ms, lidx_search_callback callback, void * context);
+
+// Starts searching a unicode token in the indexer.
+// `token`: string to search in UTF-16 encoding.
+lidx_search_handle * lidx_u_search_start(lidx * index, const UChar * utoken, lidx_search_kind kind,
+    unsigned int timeout_ms, lidx_search_callback callback, void * context);
+
+// Stops the search. It can be called from any thread until `lidx_search_finish()`
+// is called.
+void lidx_search_cancel(lidx_search_handle * search);
+
+// Returns 1 if the result of the search is available.
+int lidx_search_is_done(lidx_search_handle * search);
+
+// Waits for the end of the search and stores its result like `lidx_search()`.
+// `*p_truncated` is set to 1 when the search was stopped before the end and
+// only part of the matching documents were found. `p_truncated` can be NULL.
+// Truncated results are not stored in the query cache.
+// The handle is freed.
+//
+// The result array has to be freed using `free()`.
+int lidx_search_finish(lidx_search_handle * search, uint64_t ** p_docsids, size_t * p_count,
+    int * p_truncated);
+
+// Completes a UTF-8 prefix with the words of the index.
+// `prefix`: beginning of the words in UTF-8 encoding.
+// `max_count`: maximum number of words to return.
+// The words that contain the most documents come first. The words are
+// stored in `*p_words` and their number of documents in `*p_frequencies`,
+// which can be NULL. The number of words is stored in `*p_count`.
+// Prefixes of one or two characters are answered from precomputed lists
+// when `max_count` is 16 or less.
+// The removed documents are counted until `lidx_vacuum()` is called, so a
+// word that is only in removed documents can still be returned.
+//
+// The result has to be freed using `lidx_complete_free()`.
+int lidx_complete(lidx * index, const char * prefix, unsigned int max_count,
+    char *** p_words, uint64_t ** p_frequencies, size_t * p_count);
+
+// Completes a unicode prefix with the words of the index.
+// `prefix`: beginning of the words in UTF-16 encoding.
+int lidx_u_complete(lidx * index, const UChar * uprefix, unsigned int max_count,
+    char *** p_words, uint64_t ** p_frequencies, size_t * p_count);
+
+// Frees the result of `lidx_complete()`.
+void lidx_complete_free(char ** words, uint64_t * frequencies, size_t count);
+
 // Writes changes to disk if they are still pending in memory.
 int lidx_flush(lidx * index);
 
+// Tracing.
+// Records the calls to `lidx_set()`, `lidx_remove()`, `lidx_search()`,
+// `lidx_flush()` and their unicode variants with their arguments and their
+// duration in a binary file. The trace can be replayed with `lidx-replay`.
+// An asynchronous search is recorded by `lidx_search_finish()` as a call to
+// `lidx_search()` if the calls were traced when it started.
+// The trace replaces the content of the file.
+int lidx_trace_start(lidx * index, const char * filename);
+
+// Stops recording the calls. It's also done by `lidx_free()`.
+void lidx_trace_stop(lidx * index);
+
+// Statistics.
+// Statistics are collected for all the indexers of the process.
+
+#define LIDX_STATS_HISTOGRAM_BUCKETS 32
+
+// `buckets[0]` counts the zero values and `buckets[i]` counts the values in
+// [2^(i-1), 2^i). The last bucket also counts the larger values.
+typedef struct lidx_stats_histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t buckets[LIDX_STATS_HISTOGRAM_BUCKETS];
+} lidx_stats_histogram;
+
+typedef struct lidx_stats {
+  // Reads served from the write buffer.
+  uint64_t get_buffer_hits;
+  // Reads served by LevelDB.
+  uint64_t get_buffer_misses;
+
+  uint64_t flush_count;
+  uint64_t flush_keys;
+  uint64_t flush_bytes;
+  lidx_stats_histogram flush_latency_us;
+  // Keys written to the buffers of the indexes and not flushed yet, and
+  // size of these keys and of their values. They are not reset.
+  uint64_t buffer_keys;
+  uint64_t buffer_bytes;
+
+  // Documents added with `lidx_set()`.
+  uint64_t set_count;
+  uint64_t tokens_count;
+  lidx_stats_histogram tokens_per_document;
+  lidx_stats_histogram set_latency_us;
+
+  uint64_t remove_count;
+
+  uint64_t search_count;
+  uint64_t search_keys_scanned;
+  uint64_t search_keys_matched;
+  // Searches stopped by their deadline or cancelled, see `lidx_search_start()`.
+  uint64_t search_truncated;
+  lidx_stats_histogram search_keys_scanned_per_search;
+  lidx_stats_histogram search_latency_us;
+
+  // Calls to the ICU transliterator and word break iterator, and time spent
+  // in them.
+  uint64_t icu_calls;
+  uint64_t icu_time_ns;
+
+  // Searches served by the query cache, see `lidx_set_query_cache_size()`.
+  // The hit rate is `query_cache_hits / (query_cache_hits + query_cache_misses)`.
+  uint64_t query_cache_hits;
+  uint64_t query_cache_misses;
+  // Cached results dropped because a word they match has changed.
+  uint64_t query_cache_invalidations;
+} lidx_stats;
+
+// Stores the statistics in `* stats`.
+void lidx_get_stats(lidx_stats * stats);
+
+// Resets the statistics.
+void lidx_reset_stats(void);
+
+// Bulk builder.
+// Builds a new index from a full corpus in a fraction of the time needed by
+// `lidx_set()`: words are spilled to disk in sorted runs which are merged
+// at the end. The resulting index is identical to the one built by calling
+// `lidx_set2()` on each document in the same order.
+// Documents identifiers must be unique.
+
+typedef struct lidx_bulk lidx_bulk;
+
+// Create a new bulk builder.
+lidx_bulk * lidx_bulk_new(void);
+
+// Release resource of the bulk builder.
+void lidx_bulk_free(lidx_bulk * bulk);
+
+// Sets the amount of memory used to sort words before spilling them
+// to disk. It must be called before `lidx_bulk_open()`.
+void lidx_bulk_set_memory_limit(lidx_bulk * bulk, size_t memory_limit);
+
+// Sets the normalization of the words. See `lidx_set_normalization()`.
+void lidx_bulk_set_normalization(lidx_bulk * bulk, lidx_normalization normalization);
+
+// Creates the index, stored with LevelDB. `filename` must not exist.
+// An index stored in memory is filled with `lidx_set2()` or `lidx_restore()`.
+// `tmpdir`: directory where to store the sorted runs. If NULL, $TMPDIR or /tmp is used.
+int lidx_bulk_open(lidx_bulk * bulk, const char * filename, const char * tmpdir);
+
+// Adds a UTF-8 document to the bulk builder.
+int lidx_bulk_set2(lidx_bulk * bulk, uint64_t doc, const char * text, int tokenize_enabled);
+
+// Adds an unicode document to the bulk builder.
+int lidx_bulk_u_set2(lidx_bulk * bulk, uint64_t doc, const UChar * utext, int tokenize_enabled);
+
+// Merges the sorted runs and writes the index.
+// Returns -1 if an error occurred or if a document identifier was added twice.
+int lidx_bulk_close(lidx_bulk * bulk);
+
 #ifdef __cplusplus
 }
 #endif